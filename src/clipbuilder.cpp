@@ -0,0 +1,463 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "clipbuilder.h"
+#include "scenetrace.h"
+#include <QMap>
+#include <algorithm>
+
+ClipBuilder::ClipBuilder(const QVector3D &translation, const QQuaternion &rotation,
+                         const QVector3D &scale, const QColor &color)
+    : m_translation(translation),
+      m_rotation(rotation),
+      m_scale(scale),
+      m_color(color)
+{
+    // First frame.
+    append(TranslationX, 0, translation.x());
+    append(TranslationY, 0, translation.y());
+    append(TranslationZ, 0, translation.z());
+    append(RotationX, 0, rotation.x());
+    append(RotationY, 0, rotation.y());
+    append(RotationZ, 0, rotation.z());
+    append(RotationW, 0, rotation.scalar());
+    append(ScaleX, 0, scale.x());
+    append(ScaleY, 0, scale.y());
+    append(ScaleZ, 0, scale.z());
+    append(ColorR, 0, color.redF());
+    append(ColorG, 0, color.greenF());
+    append(ColorB, 0, color.blueF());
+}
+
+ClipBuilder ClipBuilder::fromFirstFrame(const SceneData::Frame &firstFrame, const QByteArray &modelId)
+{
+    // Same as what a new QTransform and QPhongMaterial get.
+    QVector3D translation;
+    QVector3D rotation;
+    QVector3D scale(1, 1, 1);
+    QColor color = QColor::fromRgbF(0.7, 0.7, 0.7);
+    auto it = firstFrame.modelChanges.constFind(modelId);
+    if (it != firstFrame.modelChanges.constEnd()) {
+        if (it->change & SceneData::ModelChange::Translation)
+            translation = it->translation;
+        if (it->change & SceneData::ModelChange::Rotation)
+            rotation = it->rotation;
+        if (it->change & SceneData::ModelChange::Scale)
+            scale = it->scale;
+        if (it->change & SceneData::ModelChange::Color)
+            color = it->color;
+    }
+    return ClipBuilder(translation, QQuaternion::fromEulerAngles(rotation), scale, color);
+}
+
+// With an easing curve the segment from the previous keyframe becomes a cubic Bezier. In
+// Qt3D the segment is controlled by its first keyframe's interpolation type and right
+// handle, and by the second keyframe's left handle.
+void ClipBuilder::append(int component, int t, float v, const SceneData::Easing *e)
+{
+    QVector<Qt3DAnimation::QKeyFrame> &keys(m_keys[component]);
+    // Time values are, surprisingly enough, in seconds.
+    const QVector2D p(t / 1000.0f, v);
+    Qt3DAnimation::QKeyFrame kf(p);
+    if (e && !keys.isEmpty()) {
+        Qt3DAnimation::QKeyFrame &prev(keys.last());
+        const QVector2D p0 = prev.coordinates();
+        const QVector2D d = p - p0;
+        prev.setInterpolationType(Qt3DAnimation::QKeyFrame::BezierInterpolation);
+        prev.setRightControlPoint(p0 + QVector2D(e->x1, e->y1) * d);
+        kf.setLeftControlPoint(p0 + QVector2D(e->x2, e->y2) * d);
+    }
+    keys.append(kf);
+}
+
+void ClipBuilder::addChange(int t, const SceneData::ModelChange &ch, int channelMask)
+{
+    auto easing = [&ch](int which) -> const SceneData::Easing * {
+        auto it = ch.easing.constFind(which);
+        return it != ch.easing.cend() ? &it.value() : nullptr;
+    };
+
+    // Channels must be fully specified, meaning 3 (or 4) components are required always for t/r/s.
+    if ((ch.change & SceneData::ModelChange::Translation) && (channelMask & SceneData::ModelChange::Translation)) {
+        if (ch.change & SceneData::ModelChange::TranslationX) {
+            m_translation.setX(ch.translation.x());
+            append(TranslationX, t, ch.translation.x(), easing(SceneData::ModelChange::TranslationX));
+        } else {
+            append(TranslationX, t, m_translation.x());
+        }
+
+        if (ch.change & SceneData::ModelChange::TranslationY) {
+            m_translation.setY(ch.translation.y());
+            append(TranslationY, t, ch.translation.y(), easing(SceneData::ModelChange::TranslationY));
+        } else {
+            append(TranslationY, t, m_translation.y());
+        }
+
+        if (ch.change & SceneData::ModelChange::TranslationZ) {
+            m_translation.setZ(ch.translation.z());
+            append(TranslationZ, t, ch.translation.z(), easing(SceneData::ModelChange::TranslationZ));
+        } else {
+            append(TranslationZ, t, m_translation.z());
+        }
+    }
+
+    if ((ch.change & SceneData::ModelChange::Rotation) && (channelMask & SceneData::ModelChange::Rotation)) {
+        QVector3D r = m_rotation.toEulerAngles();
+        if (ch.change & SceneData::ModelChange::RotationX)
+            r.setX(ch.rotation.x());
+        if (ch.change & SceneData::ModelChange::RotationY)
+            r.setY(ch.rotation.y());
+        if (ch.change & SceneData::ModelChange::RotationZ)
+            r.setZ(ch.rotation.z());
+        m_rotation = QQuaternion::fromEulerAngles(r);
+        // The quaternion components are eased together, using the first eased axis.
+        const SceneData::Easing *e = easing(SceneData::ModelChange::RotationX);
+        if (!e)
+            e = easing(SceneData::ModelChange::RotationY);
+        if (!e)
+            e = easing(SceneData::ModelChange::RotationZ);
+        append(RotationX, t, m_rotation.x(), e);
+        append(RotationY, t, m_rotation.y(), e);
+        append(RotationZ, t, m_rotation.z(), e);
+        append(RotationW, t, m_rotation.scalar(), e);
+    }
+
+    if ((ch.change & SceneData::ModelChange::Scale) && (channelMask & SceneData::ModelChange::Scale)) {
+        if (ch.change & SceneData::ModelChange::ScaleX) {
+            m_scale.setX(ch.scale.x());
+            append(ScaleX, t, ch.scale.x(), easing(SceneData::ModelChange::ScaleX));
+        } else {
+            append(ScaleX, t, m_scale.x());
+        }
+
+        if (ch.change & SceneData::ModelChange::ScaleY) {
+            m_scale.setY(ch.scale.y());
+            append(ScaleY, t, ch.scale.y(), easing(SceneData::ModelChange::ScaleY));
+        } else {
+            append(ScaleY, t, m_scale.y());
+        }
+
+        if (ch.change & SceneData::ModelChange::ScaleZ) {
+            m_scale.setZ(ch.scale.z());
+            append(ScaleZ, t, ch.scale.z(), easing(SceneData::ModelChange::ScaleZ));
+        } else {
+            append(ScaleZ, t, m_scale.z());
+        }
+    }
+
+    if ((ch.change & SceneData::ModelChange::Color) && (channelMask & SceneData::ModelChange::Color)) {
+        m_color = ch.color;
+        const SceneData::Easing *e = easing(SceneData::ModelChange::Color);
+        append(ColorR, t, m_color.redF(), e);
+        append(ColorG, t, m_color.greenF(), e);
+        append(ColorB, t, m_color.blueF(), e);
+    }
+}
+
+void ClipBuilder::trim()
+{
+    for (QVector<Qt3DAnimation::QKeyFrame> &keys : m_keys) {
+        if (keys.count() > 1)
+            keys.remove(0, keys.count() - 1);
+    }
+}
+
+Qt3DAnimation::QAnimationClipData ClipBuilder::clipData(int changes, int totalTime) const
+{
+    static const char *const names[ComponentCount] = {
+        "Translation X", "Translation Y", "Translation Z",
+        "Rotation X", "Rotation Y", "Rotation Z", "Rotation W",
+        "Scale X", "Scale Y", "Scale Z",
+        "Color R", "Color G", "Color B"
+    };
+    auto component = [this, totalTime](int c) {
+        Qt3DAnimation::QChannelComponent comp(QString::fromLatin1(names[c]));
+        for (const Qt3DAnimation::QKeyFrame &kf : m_keys[c])
+            comp.appendKeyFrame(kf);
+        // Last frame.
+        const float v = m_keys[c].isEmpty() ? 0.0f : m_keys[c].last().coordinates().y();
+        comp.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(totalTime / 1000.0f, v)));
+        return comp;
+    };
+
+    Qt3DAnimation::QAnimationClipData clipData;
+
+    if (changes & SceneData::ModelChange::Translation) {
+        Qt3DAnimation::QChannel trans(QStringLiteral("Translation"));
+        trans.appendChannelComponent(component(TranslationX));
+        trans.appendChannelComponent(component(TranslationY));
+        trans.appendChannelComponent(component(TranslationZ));
+        clipData.appendChannel(trans);
+    }
+
+    if (changes & SceneData::ModelChange::Rotation) {
+        // QQuaternion(scalar, x, y, z)
+        Qt3DAnimation::QChannel rot(QStringLiteral("Rotation"));
+        rot.appendChannelComponent(component(RotationW));
+        rot.appendChannelComponent(component(RotationX));
+        rot.appendChannelComponent(component(RotationY));
+        rot.appendChannelComponent(component(RotationZ));
+        clipData.appendChannel(rot);
+    }
+
+    if (changes & SceneData::ModelChange::Scale) {
+        Qt3DAnimation::QChannel scale(QStringLiteral("Scale"));
+        scale.appendChannelComponent(component(ScaleX));
+        scale.appendChannelComponent(component(ScaleY));
+        scale.appendChannelComponent(component(ScaleZ));
+        clipData.appendChannel(scale);
+    }
+
+    if (changes & SceneData::ModelChange::Color) {
+        Qt3DAnimation::QChannel color(QStringLiteral("Color"));
+        color.appendChannelComponent(component(ColorR));
+        color.appendChannelComponent(component(ColorG));
+        color.appendChannelComponent(component(ColorB));
+        clipData.appendChannel(color);
+    }
+
+    return clipData;
+}
+
+int ClipBuilder::changes(const SceneData &sd, const QByteArray &modelId)
+{
+    int changes = 0;
+    for (const SceneData::Frame &f : sd.frames) {
+        if (f.t != 0) {
+            auto it = f.modelChanges.constFind(modelId);
+            if (it != f.modelChanges.constEnd())
+                changes |= it->change;
+        }
+    }
+    return changes;
+}
+
+Qt3DAnimation::QAnimationClipData ClipBuilder::build(const SceneData &sd, const QByteArray &modelId,
+                                                     ClipBuilder initial, int changes)
+{
+    for (const SceneData::Frame &f : sd.frames) {
+        if (f.t == 0)
+            continue;
+        auto it = f.modelChanges.constFind(modelId);
+        if (it != f.modelChanges.constEnd())
+            initial.addChange(f.t, *it);
+    }
+    return initial.clipData(changes, sd.totalTime);
+}
+
+QHash<QByteArray, Qt3DAnimation::QAnimationClipData> ClipBuilder::buildAll(SceneData sd)
+{
+    TRACE_SCOPE("ClipBuilder::buildAll");
+    QHash<QByteArray, Qt3DAnimation::QAnimationClipData> clips;
+    if (sd.frames.isEmpty())
+        return clips;
+
+    // One pass over the keyframes for all models.
+    QHash<QByteArray, ClipBuilder> builders;
+    QHash<QByteArray, int> changes;
+    for (const SceneData::Frame &f : qAsConst(sd.frames)) {
+        if (f.t == 0)
+            continue;
+        for (auto it = f.modelChanges.cbegin(), ite = f.modelChanges.cend(); it != ite; ++it) {
+            auto b = builders.find(it.key());
+            if (b == builders.end())
+                b = builders.insert(it.key(), fromFirstFrame(sd.frames.first(), it.key()));
+            b->addChange(f.t, *it);
+            changes[it.key()] |= it->change;
+        }
+    }
+
+    for (auto it = builders.cbegin(), ite = builders.cend(); it != ite; ++it) {
+        int c = changes.value(it.key()) & SceneData::ModelChange::Clip;
+        // Models without a material (prefab instances) have no color to animate.
+        const SceneData::Model *mdl = sd.model(it.key());
+        if (!mdl || mdl->filename.isEmpty())
+            c &= ~SceneData::ModelChange::Color;
+        if (c)
+            clips.insert(it.key(), it->clipData(c, sd.totalTime));
+    }
+    return clips;
+}
+
+ClipWindow buildClipWindow(const SceneIndex &index, int windowIndex,
+                           int windowLength, int overlap,
+                           const QHash<QByteArray, ClipBuilder> &resume, int resumeFrame)
+{
+    TRACE_SCOPE_ARG("buildClipWindow", "window", QByteArray::number(windowIndex));
+    SceneData header = index.header;
+    const int totalTime = header.totalTime;
+
+    ClipWindow w;
+    w.index = windowIndex;
+    w.start = windowIndex * windowLength;
+    w.validFrom = w.start - overlap;
+    const bool last = w.start + windowLength >= totalTime;
+    w.end = last ? INT_MAX : w.start + windowLength;
+    const int endTime = last ? totalTime : w.end;
+    const int resumeAt = w.end - overlap;
+
+    // Models without a material (prefab instances) have no color to animate.
+    QHash<QByteArray, int> changes;
+    for (auto it = index.modelKeys.cbegin(), ite = index.modelKeys.cend(); it != ite; ++it) {
+        int c = it->changes & SceneData::ModelChange::Clip;
+        const SceneData::Model *mdl = header.model(it.key());
+        if (!mdl || mdl->filename.isEmpty())
+            c &= ~SceneData::ModelChange::Color;
+        if (c)
+            changes.insert(it.key(), c);
+    }
+
+    QHash<QByteArray, ClipBuilder> builders = resume;
+    int frame = resumeFrame;
+    bool trimmed = true; // to the window start
+    if (builders.isEmpty()) {
+        for (auto it = changes.cbegin(), ite = changes.cend(); it != ite; ++it)
+            builders.insert(it.key(), ClipBuilder::fromFirstFrame(header.frames.first(), it.key()));
+        frame = 1;
+        trimmed = false;
+    }
+    auto trimAll = [&builders] {
+        for (ClipBuilder &b : builders)
+            b.trim();
+    };
+
+    // The next keyframe after the window of each channel, needed for interpolating
+    // up to its end. Looked up in the index and read directly, since for sparsely
+    // keyed channels it can be far ahead: the first one usually ends the window's
+    // pass, the rest are read in one more pass skipping everything in between.
+    QMap<int, QHash<QByteArray, int> > nextKeys; // time, model, channel mask
+    for (auto it = changes.cbegin(), ite = changes.cend(); it != ite; ++it) {
+        const SceneIndex::ModelKeys &keys(index.modelKeys[it.key()]);
+        for (int channel = 0; channel < SceneIndex::ChannelCount; ++channel) {
+            if (!(it.value() & SceneIndex::channelMask(channel)))
+                continue;
+            const QVector<int> &times(keys.channelTimes[channel]);
+            auto next = std::upper_bound(times.cbegin(), times.cend(), endTime);
+            if (next != times.cend())
+                nextKeys[*next][it.key()] |= SceneIndex::channelMask(channel);
+        }
+    }
+
+    auto addNextKeys = [&](const SceneData::Frame &f) {
+        auto it = nextKeys.find(f.t);
+        if (it == nextKeys.end())
+            return;
+        for (auto key = it->cbegin(), keye = it->cend(); key != keye; ++key) {
+            auto ch = f.modelChanges.constFind(key.key());
+            if (ch != f.modelChanges.cend() && (ch->change & key.value()))
+                builders[key.key()].addChange(f.t, *ch, key.value());
+        }
+        nextKeys.erase(it);
+    };
+
+    int folded = 0;
+    if (frame >= 0 && frame < index.frames.count()) {
+        SceneParser::readFrames(index, frame, [&](const SceneData::Frame &f) {
+            const int frameIdx = frame++;
+            if (f.t == 0)
+                return true;
+
+            if (!trimmed && f.t > w.validFrom) {
+                trimAll();
+                trimmed = true;
+            }
+
+            if (!last && w.resumeFrame < 0 && f.t > resumeAt) {
+                w.resume = builders;
+                for (ClipBuilder &b : w.resume)
+                    b.trim();
+                w.resumeFrame = frameIdx;
+            }
+
+            if (f.t > endTime) {
+                addNextKeys(f);
+                return false;
+            }
+
+            for (auto it = f.modelChanges.cbegin(), ite = f.modelChanges.cend(); it != ite; ++it) {
+                auto b = builders.find(it.key());
+                if (b != builders.end())
+                    b->addChange(f.t, *it);
+            }
+
+            // Reading up to the window from the beginning; only the last keyframes matter.
+            if (!trimmed && ++folded % 64 == 0)
+                trimAll();
+
+            return true;
+        });
+    }
+
+    if (!nextKeys.isEmpty()) {
+        QVector<int> frames;
+        frames.reserve(nextKeys.count());
+        for (auto it = nextKeys.cbegin(), ite = nextKeys.cend(); it != ite; ++it)
+            frames.append(index.findFrame(it.key() - 1));
+        SceneParser::readFrames(index, frames, [&](const SceneData::Frame &f) {
+            addNextKeys(f);
+            return true;
+        });
+    }
+
+    if (!trimmed)
+        trimAll();
+    if (!last && w.resumeFrame < 0) {
+        // Nothing after resumeAt, so nothing was looked ahead either.
+        w.resume = builders;
+        for (ClipBuilder &b : w.resume)
+            b.trim();
+        w.resumeFrame = index.frames.count();
+    }
+
+    for (auto it = changes.cbegin(), ite = changes.cend(); it != ite; ++it)
+        w.clips.insert(it.key(), builders[it.key()].clipData(it.value(), totalTime));
+
+    return w;
+}
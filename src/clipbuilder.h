@@ -0,0 +1,130 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef CLIPBUILDER_H
+#define CLIPBUILDER_H
+
+#include "twospaceparser.h"
+#include <Qt3DAnimation/QAnimationClipData>
+#include <Qt3DAnimation/QKeyFrame>
+#include <QQuaternion>
+
+// Builds the keyframes of one model's animation clip, one keyframe at a time.
+// Does not touch any nodes, so it can be used on any thread.
+class ClipBuilder
+{
+public:
+    ClipBuilder() = default;
+    // Starts with a keyframe at t=0 holding the given values.
+    ClipBuilder(const QVector3D &translation, const QQuaternion &rotation, const QVector3D &scale, const QColor &color);
+    // The values a new model gets from the keyframe at t=0.
+    static ClipBuilder fromFirstFrame(const SceneData::Frame &firstFrame, const QByteArray &modelId);
+
+    // Appends keyframes at t ms for the channels (see SceneIndex::Channel) in channelMask.
+    void addChange(int t, const SceneData::ModelChange &ch, int channelMask = ~0);
+    // Drops all but the last keyframe of each component.
+    void trim();
+    // Clip with the channels in changes, held from the last keyframe until totalTime.
+    Qt3DAnimation::QAnimationClipData clipData(int changes, int totalTime) const;
+
+    // What is animated for modelId after t=0.
+    static int changes(const SceneData &sd, const QByteArray &modelId);
+    // Clip for the whole timeline.
+    static Qt3DAnimation::QAnimationClipData build(const SceneData &sd, const QByteArray &modelId,
+                                                   ClipBuilder initial, int changes);
+    // Clips of all animated models for the whole timeline, starting from the
+    // values at t=0. Meant to run on a worker thread.
+    static QHash<QByteArray, Qt3DAnimation::QAnimationClipData> buildAll(SceneData sd);
+
+private:
+    enum Component {
+        TranslationX, TranslationY, TranslationZ,
+        RotationX, RotationY, RotationZ, RotationW,
+        ScaleX, ScaleY, ScaleZ,
+        ColorR, ColorG, ColorB,
+        ComponentCount
+    };
+    void append(int component, int t, float v, const SceneData::Easing *e = nullptr);
+
+    QVector<Qt3DAnimation::QKeyFrame> m_keys[ComponentCount];
+    QVector3D m_translation;
+    QQuaternion m_rotation;
+    QVector3D m_scale;
+    QColor m_color;
+};
+
+// The clips of all animated models for one window of a streamed timeline.
+// Only keyframes from the last one at or before the window start (minus the
+// overlap) until the first one after the window end are included; the clip
+// times stay absolute so the animators' playheads are not affected by swaps.
+struct ClipWindow
+{
+    bool isValid() const { return index >= 0; }
+    bool covers(int pos) const { return index >= 0 && pos >= validFrom && pos < end; }
+
+    int index = -1;
+    int start = 0; // ms
+    int end = 0; // INT_MAX for the last window
+    int validFrom = 0; // start - overlap, so a swap can happen ahead of the boundary
+    QHash<QByteArray, Qt3DAnimation::QAnimationClipData> clips;
+
+    // Where building the next window continues: the builders at end - overlap.
+    QHash<QByteArray, ClipBuilder> resume;
+    int resumeFrame = -1; // in SceneIndex::frames
+};
+
+// Builds window windowIndex of windowLength ms. Continues from resume when it
+// comes from the preceding window, otherwise reads the keyframes from the
+// beginning of the file. Meant to run on a worker thread.
+ClipWindow buildClipWindow(const SceneIndex &index, int windowIndex,
+                           int windowLength, int overlap,
+                           const QHash<QByteArray, ClipBuilder> &resume, int resumeFrame);
+
+#endif
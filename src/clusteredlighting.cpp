@@ -0,0 +1,361 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "clusteredlighting.h"
+#include "scenetrace.h"
+#include <Qt3DRender/QEffect>
+#include <Qt3DRender/QTechnique>
+#include <Qt3DRender/QRenderPass>
+#include <Qt3DRender/QShaderProgram>
+#include <Qt3DRender/QFilterKey>
+#include <Qt3DRender/QGraphicsApiFilter>
+#include <Qt3DRender/QParameter>
+#include <Qt3DRender/QTexture>
+#include <Qt3DRender/QTextureImageDataGenerator>
+#include <Qt3DRender/QTextureImageData>
+#include <QUrl>
+#include <QtMath>
+#include <algorithm>
+
+class LightGridImageGenerator : public Qt3DRender::QTextureImageDataGenerator
+{
+public:
+    LightGridImageGenerator(const QByteArray &data, int width, int height, int generation)
+        : m_data(data), m_width(width), m_height(height), m_generation(generation)
+    { }
+
+    Qt3DRender::QTextureImageDataPtr operator()() override
+    {
+        Qt3DRender::QTextureImageDataPtr img = Qt3DRender::QTextureImageDataPtr::create();
+        img->setTarget(QOpenGLTexture::Target2D);
+        img->setFormat(QOpenGLTexture::RGBA32F);
+        img->setPixelFormat(QOpenGLTexture::RGBA);
+        img->setPixelType(QOpenGLTexture::Float32);
+        img->setWidth(m_width);
+        img->setHeight(m_height);
+        img->setDepth(1);
+        img->setLayers(1);
+        img->setFaces(1);
+        img->setMipLevels(1);
+        img->setData(m_data, 16);
+        return img;
+    }
+
+    bool operator==(const Qt3DRender::QTextureImageDataGenerator &other) const override
+    {
+        const LightGridImageGenerator *g = functor_cast<LightGridImageGenerator>(&other);
+        return g && g->m_generation == m_generation;
+    }
+
+    QT3D_FUNCTOR(LightGridImageGenerator)
+
+private:
+    QByteArray m_data;
+    int m_width;
+    int m_height;
+    int m_generation;
+};
+
+LightGridImage::LightGridImage(Qt3DCore::QNode *parent)
+    : Qt3DRender::QAbstractTextureImage(parent)
+{
+}
+
+void LightGridImage::setData(const QByteArray &data, int width, int height)
+{
+    m_generator.reset(new LightGridImageGenerator(data, width, height, ++m_generation));
+    notifyDataGeneratorChanged();
+}
+
+Qt3DRender::QTextureImageDataGeneratorPtr LightGridImage::dataGenerator() const
+{
+    return m_generator;
+}
+
+ClusteredLighting::ClusteredLighting(int viewCount, Qt3DCore::QNode *parent)
+    : Qt3DCore::QNode(parent)
+{
+    m_effect = new Qt3DRender::QEffect(this);
+
+    Qt3DRender::QTechnique *technique = new Qt3DRender::QTechnique;
+    technique->graphicsApiFilter()->setApi(Qt3DRender::QGraphicsApiFilter::OpenGL);
+    technique->graphicsApiFilter()->setProfile(Qt3DRender::QGraphicsApiFilter::CoreProfile);
+    technique->graphicsApiFilter()->setMajorVersion(3);
+    technique->graphicsApiFilter()->setMinorVersion(2);
+    Qt3DRender::QFilterKey *filterKey = new Qt3DRender::QFilterKey;
+    filterKey->setName(QStringLiteral("renderingStyle"));
+    filterKey->setValue(QStringLiteral("forward")); // what QForwardRenderer selects
+    technique->addFilterKey(filterKey);
+
+    Qt3DRender::QShaderProgram *program = new Qt3DRender::QShaderProgram;
+    program->setVertexShaderCode(Qt3DRender::QShaderProgram::loadSource(QUrl(QStringLiteral("qrc:/shaders/clusteredlight.vert"))));
+    program->setFragmentShaderCode(Qt3DRender::QShaderProgram::loadSource(QUrl(QStringLiteral("qrc:/shaders/clusteredlight.frag"))));
+    Qt3DRender::QRenderPass *pass = new Qt3DRender::QRenderPass;
+    pass->setShaderProgram(program);
+    technique->addRenderPass(pass);
+    m_effect->addTechnique(technique);
+
+    m_directionalCount = new Qt3DRender::QParameter(QStringLiteral("dirLightCount"), 0);
+    m_directionalLights = new Qt3DRender::QParameter(QStringLiteral("dirLightDirections[0]"), QVariantList());
+    m_effect->addParameter(new Qt3DRender::QParameter(QStringLiteral("tileSize"), int(TileSize)));
+    m_effect->addParameter(new Qt3DRender::QParameter(QStringLiteral("ambient"), QColor::fromRgbF(0.05, 0.05, 0.05)));
+    m_effect->addParameter(m_directionalCount);
+    m_effect->addParameter(m_directionalLights);
+
+    m_views.resize(qMax(1, viewCount));
+    for (View &v : m_views) {
+        v.grid = new Qt3DRender::QTexture2D(this);
+        v.grid->setFormat(Qt3DRender::QAbstractTexture::RGBA32F);
+        v.grid->setMinificationFilter(Qt3DRender::QAbstractTexture::Nearest);
+        v.grid->setMagnificationFilter(Qt3DRender::QAbstractTexture::Nearest);
+        v.grid->setGenerateMipMaps(false);
+        v.gridImage = new LightGridImage;
+        v.grid->addTextureImage(v.gridImage);
+
+        v.gridParameter = new Qt3DRender::QParameter(QStringLiteral("lightGrid"), v.grid, this);
+        v.origin = new Qt3DRender::QParameter(QStringLiteral("viewOrigin"), QPoint(), this);
+        v.tilesX = new Qt3DRender::QParameter(QStringLiteral("tilesX"), 1, this);
+        v.tileBase = new Qt3DRender::QParameter(QStringLiteral("tileBase"), 0, this);
+        v.indexBase = new Qt3DRender::QParameter(QStringLiteral("indexBase"), 0, this);
+    }
+    if (m_views.count() == 1) {
+        for (Qt3DRender::QParameter *p : viewParameters(0))
+            m_effect->addParameter(p);
+    }
+}
+
+QVector<Qt3DRender::QParameter *> ClusteredLighting::viewParameters(int view) const
+{
+    const View &v(m_views[view]);
+    return { v.gridParameter, v.origin, v.tilesX, v.tileBase, v.indexBase };
+}
+
+float ClusteredLighting::averageLightsPerTile() const
+{
+    float sum = 0;
+    for (const View &v : m_views)
+        sum += v.averageLightsPerTile;
+    return sum / m_views.count();
+}
+
+int ClusteredLighting::maxLightsPerTile() const
+{
+    int result = 0;
+    for (const View &v : m_views)
+        result = qMax(result, v.maxLightsPerTile);
+    return result;
+}
+
+void ClusteredLighting::addPointLight(const QVector3D &position, float range, const QColor &color)
+{
+    m_lights.append({ position, range, color });
+}
+
+void ClusteredLighting::addDirectionalLight(const QVector3D &direction)
+{
+    if (m_directions.count() == MaxDirectionalLights) {
+        qWarning("Too many directional lights; only %d will be used", int(MaxDirectionalLights));
+        return;
+    }
+    m_directions.append(direction.normalized());
+    m_directionalLights->setValue(m_directions);
+    m_directionalCount->setValue(m_directions.count());
+}
+
+void ClusteredLighting::update(int viewIndex, const QMatrix4x4 &view, const QMatrix4x4 &projection, const QRect &viewport)
+{
+    TRACE_SCOPE("ClusteredLighting::update");
+    if (viewport.isEmpty())
+        return;
+
+    View &v(m_views[viewIndex]);
+    const QSize surfaceSize = viewport.size();
+    const int tilesX = (surfaceSize.width() + TileSize - 1) / TileSize;
+    const int tilesY = (surfaceSize.height() + TileSize - 1) / TileSize;
+    const int tileCount = tilesX * tilesY;
+    const QRect allTiles(0, 0, tilesX, tilesY);
+    const float nearPlane = projection(2, 3) / (projection(2, 2) - 1.0f); // perspective only
+
+    // Screen space tile rectangle of each light's bounding box.
+    m_tileRects.resize(m_lights.count());
+    m_lightDistances.resize(m_lights.count());
+    for (int i = 0; i < m_lights.count(); ++i) {
+        const Light &light(m_lights[i]);
+        const QVector3D p = view * light.position;
+        m_lightDistances[i] = p.length() - light.range;
+        QRect &rect(m_tileRects[i]);
+        rect = QRect();
+        if (p.z() - light.range > -nearPlane)
+            continue; // behind the camera
+        if (p.z() + light.range > -nearPlane) {
+            rect = allTiles; // the camera is (nearly) inside
+        } else {
+            float x0 = 1, y0 = 1, x1 = -1, y1 = -1;
+            for (int c = 0; c < 8; ++c) {
+                const QVector3D corner(p.x() + (c & 1 ? light.range : -light.range),
+                                       p.y() + (c & 2 ? light.range : -light.range),
+                                       p.z() + (c & 4 ? light.range : -light.range));
+                const QVector3D ndc = projection.map(corner); // divides by w
+                x0 = qMin(x0, ndc.x());
+                y0 = qMin(y0, ndc.y());
+                x1 = qMax(x1, ndc.x());
+                y1 = qMax(y1, ndc.y());
+            }
+            if (x1 < -1 || y1 < -1 || x0 > 1 || y0 > 1)
+                continue;
+            // Same origin as gl_FragCoord, bottom left.
+            const int tx0 = int((x0 * 0.5f + 0.5f) * surfaceSize.width()) / TileSize;
+            const int ty0 = int((y0 * 0.5f + 0.5f) * surfaceSize.height()) / TileSize;
+            const int tx1 = int((x1 * 0.5f + 0.5f) * surfaceSize.width()) / TileSize;
+            const int ty1 = int((y1 * 0.5f + 0.5f) * surfaceSize.height()) / TileSize;
+            rect = QRect(QPoint(tx0, ty0), QPoint(tx1, ty1)).intersected(allTiles);
+        }
+    }
+
+    if (m_lightLimit > 0) {
+        m_visibleLights.clear();
+        for (int i = 0; i < m_lights.count(); ++i) {
+            if (!m_tileRects[i].isEmpty())
+                m_visibleLights.append(i);
+        }
+        if (m_visibleLights.count() > m_lightLimit) {
+            auto limit = m_visibleLights.begin() + m_lightLimit;
+            std::nth_element(m_visibleLights.begin(), limit, m_visibleLights.end(), [this](int a, int b) {
+                return m_lightDistances[a] < m_lightDistances[b];
+            });
+            for (auto it = limit; it != m_visibleLights.end(); ++it)
+                m_tileRects[*it] = QRect();
+        }
+    }
+
+    m_tileCounts.fill(0, tileCount);
+    for (const QRect &rect : qAsConst(m_tileRects)) {
+        for (int y = rect.top(); y <= rect.bottom(); ++y) {
+            for (int x = rect.left(); x <= rect.right(); ++x)
+                ++m_tileCounts[y * tilesX + x];
+        }
+    }
+
+    m_tileOffsets.resize(tileCount);
+    int indexCount = 0;
+    v.maxLightsPerTile = 0;
+    for (int t = 0; t < tileCount; ++t) {
+        m_tileOffsets[t] = indexCount;
+        indexCount += m_tileCounts[t];
+        v.maxLightsPerTile = qMax(v.maxLightsPerTile, m_tileCounts[t]);
+    }
+    v.averageLightsPerTile = float(indexCount) / tileCount;
+
+    // Lights (2 texels each), then one (offset, count) texel per tile, then
+    // the light indices, four per texel.
+    const int tileBase = m_lights.count() * 2;
+    const int indexBase = tileBase + tileCount;
+    const int texels = indexBase + (indexCount + 3) / 4;
+    int height = 1;
+    while (height * GridWidth < texels)
+        height *= 2;
+
+    m_data.fill(0.0f, height * GridWidth * 4);
+    float *d = m_data.data();
+    for (const Light &light : m_lights) {
+        *d++ = light.position.x();
+        *d++ = light.position.y();
+        *d++ = light.position.z();
+        *d++ = light.range;
+        *d++ = light.color.redF();
+        *d++ = light.color.greenF();
+        *d++ = light.color.blueF();
+        *d++ = 1.0f;
+    }
+    for (int t = 0; t < tileCount; ++t) {
+        *d++ = m_tileOffsets[t];
+        *d++ = m_tileCounts[t];
+        d += 2;
+    }
+    for (int i = 0; i < m_lights.count(); ++i) {
+        const QRect &rect(m_tileRects[i]);
+        for (int y = rect.top(); y <= rect.bottom(); ++y) {
+            for (int x = rect.left(); x <= rect.right(); ++x)
+                d[m_tileOffsets[y * tilesX + x]++] = i;
+        }
+    }
+
+    const QByteArray data(reinterpret_cast<const char *>(m_data.constData()), m_data.count() * int(sizeof(float)));
+    v.origin->setValue(QPoint(viewport.x(), viewport.y()));
+    if (data == v.uploaded)
+        return; // nothing moved
+    v.uploaded = data;
+
+    if (height != v.gridHeight) {
+        v.grid->setSize(GridWidth, height);
+        v.gridHeight = height;
+    }
+    v.gridImage->setData(data, GridWidth, height);
+    v.tilesX->setValue(tilesX);
+    v.tileBase->setValue(tileBase);
+    v.indexBase->setValue(indexBase);
+}
+
+ClusteredLightMaterial::ClusteredLightMaterial(ClusteredLighting *lighting, Qt3DCore::QNode *parent)
+    : Qt3DRender::QMaterial(parent)
+{
+    setEffect(lighting->effect());
+    m_kd = new Qt3DRender::QParameter(QStringLiteral("kd"), m_diffuse);
+    addParameter(m_kd);
+}
+
+void ClusteredLightMaterial::setDiffuse(const QColor &color)
+{
+    if (m_diffuse == color)
+        return;
+    m_diffuse = color;
+    m_kd->setValue(color);
+    emit diffuseChanged(color);
+}
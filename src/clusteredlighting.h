@@ -0,0 +1,186 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef CLUSTEREDLIGHTING_H
+#define CLUSTEREDLIGHTING_H
+
+#include <Qt3DRender/QMaterial>
+#include <Qt3DRender/QAbstractTextureImage>
+#include <QColor>
+#include <QMatrix4x4>
+#include <QRect>
+#include <QSize>
+#include <QVector3D>
+#include <QVector>
+
+namespace Qt3DRender {
+class QEffect;
+class QParameter;
+class QTexture2D;
+}
+
+class LightGridImage : public Qt3DRender::QAbstractTextureImage
+{
+    Q_OBJECT
+
+public:
+    explicit LightGridImage(Qt3DCore::QNode *parent = nullptr);
+
+    // data is width x height RGBA32F texels.
+    void setData(const QByteArray &data, int width, int height);
+
+protected:
+    Qt3DRender::QTextureImageDataGeneratorPtr dataGenerator() const override;
+
+private:
+    Qt3DRender::QTextureImageDataGeneratorPtr m_generator;
+    int m_generation = 0;
+};
+
+// Point lights with a range, assigned to screen space tiles on the CPU every
+// frame. The lights and the per-tile light lists go to the shaders in a float
+// texture, so this works with any OpenGL 3.2 implementation, including
+// software ones. Shading cost then depends on the lights overlapping a tile
+// instead of on the total light count.
+//
+// Each view (a camera and its viewport) has a tile grid of its own. With one
+// view its parameters are on the effect. With more, they go on the frame graph
+// branch of each view instead, see viewParameters() and MultiViewRenderer.
+class ClusteredLighting : public Qt3DCore::QNode
+{
+    Q_OBJECT
+
+public:
+    enum { TileSize = 32, GridWidth = 1024 }; // pixels, texels
+    enum { MaxDirectionalLights = 4 };
+
+    explicit ClusteredLighting(int viewCount = 1, Qt3DCore::QNode *parent = nullptr);
+
+    Qt3DRender::QEffect *effect() const { return m_effect; }
+    int viewCount() const { return m_views.count(); }
+    QVector<Qt3DRender::QParameter *> viewParameters(int view) const;
+
+    void addPointLight(const QVector3D &position, float range, const QColor &color);
+    void addDirectionalLight(const QVector3D &direction);
+    int pointLightCount() const { return m_lights.count(); }
+
+    // At most this many of the point lights in view are assigned to tiles, the
+    // ones closest to the camera. 0 for no limit.
+    int lightLimit() const { return m_lightLimit; }
+    void setLightLimit(int count) { m_lightLimit = qMax(0, count); }
+
+    // Reassigns the lights to the tiles of a view for its camera. The viewport is
+    // in pixels, with the origin at the bottom left like gl_FragCoord.
+    void update(int view, const QMatrix4x4 &viewMatrix, const QMatrix4x4 &projection, const QRect &viewport);
+
+    // Over all views.
+    float averageLightsPerTile() const;
+    int maxLightsPerTile() const;
+
+private:
+    struct Light {
+        QVector3D position;
+        float range;
+        QColor color;
+    };
+    QVector<Light> m_lights;
+    QVariantList m_directions;
+
+    Qt3DRender::QEffect *m_effect;
+    Qt3DRender::QParameter *m_directionalCount;
+    Qt3DRender::QParameter *m_directionalLights;
+
+    struct View {
+        Qt3DRender::QTexture2D *grid;
+        LightGridImage *gridImage;
+        Qt3DRender::QParameter *gridParameter;
+        Qt3DRender::QParameter *origin;
+        Qt3DRender::QParameter *tilesX;
+        Qt3DRender::QParameter *tileBase;
+        Qt3DRender::QParameter *indexBase;
+        int gridHeight = 0;
+        QByteArray uploaded;
+        float averageLightsPerTile = 0;
+        int maxLightsPerTile = 0;
+    };
+    QVector<View> m_views;
+
+    int m_lightLimit = 0;
+
+    QVector<QRect> m_tileRects; // per light, empty when not visible
+    QVector<float> m_lightDistances; // per light, from the camera to its range
+    QVector<int> m_visibleLights;
+    QVector<int> m_tileCounts;
+    QVector<int> m_tileOffsets;
+    QVector<float> m_data;
+};
+
+// Diffuse material for ClusteredLighting. Has the same diffuse property as
+// QPhongMaterial so it can be animated the same way.
+class ClusteredLightMaterial : public Qt3DRender::QMaterial
+{
+    Q_OBJECT
+    Q_PROPERTY(QColor diffuse READ diffuse WRITE setDiffuse NOTIFY diffuseChanged)
+
+public:
+    ClusteredLightMaterial(ClusteredLighting *lighting, Qt3DCore::QNode *parent = nullptr);
+
+    QColor diffuse() const { return m_diffuse; }
+    void setDiffuse(const QColor &color);
+
+signals:
+    void diffuseChanged(const QColor &color);
+
+private:
+    QColor m_diffuse = QColor::fromRgbF(0.7, 0.7, 0.7);
+    Qt3DRender::QParameter *m_kd;
+};
+
+#endif
@@ -0,0 +1,420 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "compactscenedata.h"
+#include <QStack>
+#include <algorithm>
+#include <cstring>
+
+Q_LOGGING_CATEGORY(lcSceneMemory, "rtscpl.memory")
+
+void *SceneArena::allocateBytes(size_t size, size_t align)
+{
+    if (!m_chunks.isEmpty()) {
+        Chunk &c(m_chunks.last());
+        const size_t start = (c.used + align - 1) & ~(align - 1);
+        if (start + size <= c.size) {
+            c.used = start + size;
+            return c.data + start;
+        }
+    }
+
+    // malloc'ed memory is suitably aligned for any of the types stored here.
+    const size_t chunkSize = qMax(size, ChunkSize);
+    Chunk c = { static_cast<char *>(std::malloc(chunkSize)), chunkSize, size };
+    Q_CHECK_PTR(c.data);
+    m_chunks.append(c);
+    return c.data;
+}
+
+void SceneArena::clear()
+{
+    for (const Chunk &c : qAsConst(m_chunks))
+        std::free(c.data);
+    m_chunks.clear();
+}
+
+size_t SceneArena::bytesReserved() const
+{
+    size_t n = 0;
+    for (const Chunk &c : m_chunks)
+        n += c.size;
+    return n;
+}
+
+size_t SceneArena::bytesUsed() const
+{
+    size_t n = 0;
+    for (const Chunk &c : m_chunks)
+        n += c.used;
+    return n;
+}
+
+static void gatherModels(const QHash<QByteArray, SceneData::Model> &models, int parent,
+                         QVector<QPair<QByteArray, const SceneData::Model *> > *order, QVector<int> *parents,
+                         int firstModelIndex)
+{
+    for (auto it = models.cbegin(), ite = models.cend(); it != ite; ++it) {
+        const int idx = order->count();
+        order->append(qMakePair(it.key(), &it.value()));
+        parents->append(parent);
+        gatherModels(it.value().childModels, firstModelIndex + idx, order, parents, firstModelIndex);
+    }
+}
+
+static inline quint32 floatBits(float f)
+{
+    quint32 u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static inline float bitsFloat(quint32 u)
+{
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+void CompactSceneData::build(const SceneData &sd)
+{
+    clear();
+
+    QVector<QByteArray> ids;
+    for (const QByteArray &id : sd.cameras)
+        ids.append(id);
+    for (const QByteArray &id : sd.lights)
+        ids.append(id);
+    m_cameraCount = sd.cameras.count();
+    m_lightCount = sd.lights.count();
+
+    QVector<QPair<QByteArray, const SceneData::Model *> > models;
+    QVector<int> modelParents;
+    const int firstModelIndex = ids.count();
+    gatherModels(sd.models, -1, &models, &modelParents, firstModelIndex);
+    // Models inside prefabs follow as separate trees; instances are not expanded.
+    for (const SceneData::Prefab &prefab : sd.prefabs)
+        gatherModels(prefab.models, -1, &models, &modelParents, firstModelIndex);
+    for (const auto &m : qAsConst(models))
+        ids.append(m.first);
+
+    m_entityCount = ids.count();
+    m_totalTime = sd.totalTime;
+
+    // Cameras, lights and models have separate namespaces. Within the models the
+    // first one in pre-order wins.
+    QHash<QByteArray, int> index[3];
+    for (int i = 0; i < ids.count(); ++i) {
+        const EntityKind kind = entityKind(i);
+        if (!index[kind].contains(ids[i]))
+            index[kind].insert(ids[i], i);
+    }
+
+    // Strings: all ids, then each distinct filename once.
+    QVector<QByteArray> strings = ids;
+    QHash<QString, int> filenameIndex;
+    qint32 *filenames = m_arena.allocate<qint32>(m_entityCount);
+    for (int i = 0; i < m_entityCount; ++i) {
+        filenames[i] = -1;
+        if (i >= firstModelIndex && !models[i - firstModelIndex].second->filename.isEmpty()) {
+            const QString &fn(models[i - firstModelIndex].second->filename);
+            auto it = filenameIndex.find(fn);
+            if (it == filenameIndex.end()) {
+                it = filenameIndex.insert(fn, strings.count());
+                strings.append(fn.toUtf8());
+            }
+            filenames[i] = it.value();
+        }
+    }
+    m_filenames = filenames;
+
+    quint32 *offsets = m_arena.allocate<quint32>(strings.count() + 1);
+    quint32 size = 0;
+    for (int i = 0; i < strings.count(); ++i) {
+        offsets[i] = size;
+        size += strings[i].size();
+    }
+    offsets[strings.count()] = size;
+    char *stringData = m_arena.allocate<char>(qMax<quint32>(size, 1));
+    for (int i = 0; i < strings.count(); ++i)
+        memcpy(stringData + offsets[i], strings[i].constData(), strings[i].size());
+    m_stringOffsets = offsets;
+    m_stringData = stringData;
+
+    // The index breaks ties, so that a lookup finds the first in pre-order.
+    quint32 *sortedIds = m_arena.allocate<quint32>(m_entityCount);
+    for (int i = 0; i < m_entityCount; ++i)
+        sortedIds[i] = i;
+    std::sort(sortedIds, sortedIds + m_entityCount, [this, &ids](quint32 a, quint32 b) {
+        const EntityKind ka = entityKind(a), kb = entityKind(b);
+        if (ka != kb)
+            return ka < kb;
+        return ids[a] < ids[b] || (ids[a] == ids[b] && a < b);
+    });
+    m_sortedIds = sortedIds;
+
+    qint32 *parents = m_arena.allocate<qint32>(m_entityCount);
+    for (int i = 0; i < m_entityCount; ++i)
+        parents[i] = i >= firstModelIndex ? modelParents[i - firstModelIndex] : -1;
+    m_parents = parents;
+
+    // Keyframes. Size the change stream first so that it is one contiguous block.
+    m_frameCount = sd.frames.count();
+    quint32 words = 0;
+    for (const SceneData::Frame &f : sd.frames) {
+        for (auto it = f.cameraChanges.cbegin(), ite = f.cameraChanges.cend(); it != ite; ++it)
+            words += 2 + valueCount(Camera, it.value().change);
+        for (auto it = f.lightChanges.cbegin(), ite = f.lightChanges.cend(); it != ite; ++it)
+            words += 2 + valueCount(Light, it.value().change);
+        for (auto it = f.modelChanges.cbegin(), ite = f.modelChanges.cend(); it != ite; ++it)
+            words += 2 + valueCount(Model, it.value().change) + easingWords(it.value());
+    }
+
+    FrameRecord *frames = m_arena.allocate<FrameRecord>(qMax(m_frameCount, 1));
+    quint32 *changes = m_arena.allocate<quint32>(qMax<quint32>(words, 1));
+    quint32 *p = changes;
+
+    auto header = [&](EntityKind kind, const QByteArray &id, int mask, int extraWords) {
+        *p++ = index[kind].value(id, -1);
+        *p++ = quint32(mask) | (extraWords ? HasEasing : 0) | (quint32(valueCount(kind, mask) + extraWords) << 16);
+    };
+    auto vec3 = [&p](const QVector3D &v) {
+        *p++ = floatBits(v.x());
+        *p++ = floatBits(v.y());
+        *p++ = floatBits(v.z());
+    };
+
+    for (int fi = 0; fi < m_frameCount; ++fi) {
+        const SceneData::Frame &f(sd.frames[fi]);
+        frames[fi].t = f.t;
+        frames[fi].offset = quint32(p - changes);
+        frames[fi].count = f.cameraChanges.count() + f.lightChanges.count() + f.modelChanges.count();
+
+        for (auto it = f.cameraChanges.cbegin(), ite = f.cameraChanges.cend(); it != ite; ++it) {
+            const SceneData::CameraChange &ch(it.value());
+            header(Camera, it.key(), ch.change, 0);
+            if (ch.change & SceneData::CameraChange::Position)
+                vec3(ch.position);
+            if (ch.change & SceneData::CameraChange::ViewCenter)
+                vec3(ch.viewCenter);
+        }
+        for (auto it = f.lightChanges.cbegin(), ite = f.lightChanges.cend(); it != ite; ++it) {
+            const SceneData::LightChange &ch(it.value());
+            header(Light, it.key(), ch.change, 0);
+            if (ch.change & SceneData::LightChange::Position)
+                vec3(ch.position);
+        }
+        for (auto it = f.modelChanges.cbegin(), ite = f.modelChanges.cend(); it != ite; ++it) {
+            const SceneData::ModelChange &ch(it.value());
+            header(Model, it.key(), ch.change, easingWords(ch));
+            const float v[9] = {
+                ch.translation.x(), ch.translation.y(), ch.translation.z(),
+                ch.rotation.x(), ch.rotation.y(), ch.rotation.z(),
+                ch.scale.x(), ch.scale.y(), ch.scale.z()
+            };
+            for (int bit = 0; bit < 9; ++bit) {
+                if (ch.change & (1 << bit))
+                    *p++ = floatBits(v[bit]);
+            }
+            if (ch.change & SceneData::ModelChange::Color)
+                *p++ = ch.color.rgba();
+            if (ch.change & SceneData::ModelChange::Visible)
+                *p++ = ch.visible;
+            if (!ch.easing.isEmpty()) {
+                // eased bits, then the four handle values for each, in bit order
+                quint32 eased = 0;
+                for (auto e = ch.easing.cbegin(), ee = ch.easing.cend(); e != ee; ++e)
+                    eased |= quint32(e.key());
+                *p++ = eased;
+                for (int bit = 0; bit < 16; ++bit) {
+                    if (eased & (1 << bit)) {
+                        const SceneData::Easing e = ch.easing.value(1 << bit);
+                        *p++ = floatBits(e.x1);
+                        *p++ = floatBits(e.y1);
+                        *p++ = floatBits(e.x2);
+                        *p++ = floatBits(e.y2);
+                    }
+                }
+            }
+        }
+    }
+    Q_ASSERT(quint32(p - changes) == words);
+
+    m_frames = frames;
+    m_changes = changes;
+}
+
+void CompactSceneData::clear()
+{
+    m_arena.clear();
+    m_cameraCount = m_lightCount = m_entityCount = m_frameCount = 0;
+    m_totalTime = 0;
+    m_stringData = nullptr;
+    m_stringOffsets = nullptr;
+    m_sortedIds = nullptr;
+    m_parents = nullptr;
+    m_filenames = nullptr;
+    m_frames = nullptr;
+    m_changes = nullptr;
+}
+
+CompactSceneData::EntityKind CompactSceneData::entityKind(int entity) const
+{
+    if (entity < m_cameraCount)
+        return Camera;
+    if (entity < m_cameraCount + m_lightCount)
+        return Light;
+    return Model;
+}
+
+int CompactSceneData::easingWords(const SceneData::ModelChange &ch)
+{
+    return ch.easing.isEmpty() ? 0 : 1 + 4 * ch.easing.count();
+}
+
+int CompactSceneData::valueCount(EntityKind kind, int mask)
+{
+    switch (kind) {
+    case Camera:
+    case Light:
+        // positions and view centers always carry all three components
+        return 3 * qPopulationCount(quint32(mask));
+    default:
+        return qPopulationCount(quint32(mask));
+    }
+}
+
+QByteArray CompactSceneData::string(int idx) const
+{
+    return QByteArray(m_stringData + m_stringOffsets[idx], m_stringOffsets[idx + 1] - m_stringOffsets[idx]);
+}
+
+int CompactSceneData::entityIndex(EntityKind kind, const QByteArray &id) const
+{
+    // Compares the string table in place, without creating a QByteArray per step.
+    auto less = [this](quint32 entity, EntityKind kind, const QByteArray &key) {
+        const EntityKind k = entityKind(entity);
+        if (k != kind)
+            return k < kind;
+        const quint32 len = m_stringOffsets[entity + 1] - m_stringOffsets[entity];
+        const int r = memcmp(m_stringData + m_stringOffsets[entity], key.constData(), qMin<quint32>(len, key.size()));
+        return r < 0 || (r == 0 && len < quint32(key.size()));
+    };
+    const quint32 *it = std::lower_bound(m_sortedIds, m_sortedIds + m_entityCount, id,
+                                         [&](quint32 entity, const QByteArray &key) { return less(entity, kind, key); });
+    if (it != m_sortedIds + m_entityCount && entityKind(*it) == kind && string(*it) == id)
+        return int(*it);
+    return -1;
+}
+
+QString CompactSceneData::modelFilename(int entity) const
+{
+    return m_filenames[entity] >= 0 ? QString::fromUtf8(string(m_filenames[entity])) : QString();
+}
+
+static QVector3D readVec3(const quint32 *&p)
+{
+    const QVector3D v(bitsFloat(p[0]), bitsFloat(p[1]), bitsFloat(p[2]));
+    p += 3;
+    return v;
+}
+
+SceneData::CameraChange CompactSceneData::cameraChange(const Change &c) const
+{
+    SceneData::CameraChange ch;
+    ch.change = c.mask;
+    const quint32 *p = c.values;
+    if (c.mask & SceneData::CameraChange::Position)
+        ch.position = readVec3(p);
+    if (c.mask & SceneData::CameraChange::ViewCenter)
+        ch.viewCenter = readVec3(p);
+    return ch;
+}
+
+SceneData::LightChange CompactSceneData::lightChange(const Change &c) const
+{
+    SceneData::LightChange ch;
+    ch.change = c.mask;
+    const quint32 *p = c.values;
+    if (c.mask & SceneData::LightChange::Position)
+        ch.position = readVec3(p);
+    return ch;
+}
+
+SceneData::ModelChange CompactSceneData::modelChange(const Change &c) const
+{
+    SceneData::ModelChange ch;
+    ch.change = c.mask & ~HasEasing;
+    const quint32 *p = c.values;
+    float v[9] = {};
+    for (int bit = 0; bit < 9; ++bit) {
+        if (c.mask & (1 << bit))
+            v[bit] = bitsFloat(*p++);
+    }
+    ch.translation = QVector3D(v[0], v[1], v[2]);
+    ch.rotation = QVector3D(v[3], v[4], v[5]);
+    ch.scale = QVector3D(v[6], v[7], v[8]);
+    if (c.mask & SceneData::ModelChange::Color)
+        ch.color = QColor::fromRgba(*p++);
+    if (c.mask & SceneData::ModelChange::Visible)
+        ch.visible = *p++ != 0;
+    if (c.mask & HasEasing) {
+        const quint32 eased = *p++;
+        for (int bit = 0; bit < 16; ++bit) {
+            if (eased & (1 << bit)) {
+                SceneData::Easing e(bitsFloat(p[0]), bitsFloat(p[1]), bitsFloat(p[2]), bitsFloat(p[3]));
+                e.valid = true;
+                ch.easing.insert(1 << bit, e);
+                p += 4;
+            }
+        }
+    }
+    return ch;
+}
@@ -0,0 +1,176 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef COMPACTSCENEDATA_H
+#define COMPACTSCENEDATA_H
+
+#include "twospaceparser.h"
+#include <QLoggingCategory>
+#include <cstdlib>
+
+Q_DECLARE_LOGGING_CATEGORY(lcSceneMemory)
+
+// Bump allocator handing out memory from large chunks. Everything is released
+// at once when the arena is cleared or destroyed; there is no per-object free.
+class SceneArena
+{
+public:
+    SceneArena() = default;
+    ~SceneArena() { clear(); }
+
+    template <typename T>
+    T *allocate(size_t count) { return static_cast<T *>(allocateBytes(count * sizeof(T), alignof(T))); }
+    void *allocateBytes(size_t size, size_t align);
+    void clear();
+
+    size_t bytesReserved() const;
+    size_t bytesUsed() const;
+
+private:
+    Q_DISABLE_COPY(SceneArena)
+
+    struct Chunk {
+        char *data;
+        size_t size;
+        size_t used;
+    };
+    QVector<Chunk> m_chunks;
+    static const size_t ChunkSize = 64 * 1024;
+};
+
+// Read-only, compact equivalent of SceneData. Entities (cameras, lights, then
+// models in pre-order) are addressed by index, the hierarchy is a flat parent
+// index array, and each keyframe change is a small header followed by only the
+// values that are set in its change mask. See rtscpl.memory for how it compares.
+class CompactSceneData
+{
+public:
+    enum EntityKind {
+        Camera,
+        Light,
+        Model
+    };
+
+    CompactSceneData() = default;
+
+    void build(const SceneData &sd);
+    void clear();
+
+    int entityCount() const { return m_entityCount; }
+    EntityKind entityKind(int entity) const;
+    QByteArray entityId(int entity) const { return string(entity); }
+    // Cameras, lights and models have separate namespaces. With models sharing
+    // an id (prefab children) this is the first one in pre-order. -1 if not found.
+    int entityIndex(EntityKind kind, const QByteArray &id) const;
+    int parentIndex(int entity) const { return m_parents[entity]; } // -1 for top-level models, cameras and lights
+    QString modelFilename(int entity) const;
+
+    int totalTime() const { return m_totalTime; }
+    int frameCount() const { return m_frameCount; }
+    int frameTime(int frame) const { return m_frames[frame].t; }
+
+    enum {
+        HasEasing = 0x8000 // model changes: easing handles follow the values
+    };
+
+    struct Change {
+        int entity; // -1 if the id was not declared
+        int mask; // SceneData::*Change bits, plus HasEasing
+        const quint32 *values; // floats (colors as QRgb) for the set bits only, in bit order
+    };
+
+    template <typename F>
+    void forEachChange(int frame, F func) const
+    {
+        const quint32 *p = m_changes + m_frames[frame].offset;
+        for (quint32 i = 0; i < m_frames[frame].count; ++i) {
+            const Change c = { int(p[0]), int(p[1] & 0xFFFF), p + 2 };
+            func(c);
+            p += 2 + (p[1] >> 16);
+        }
+    }
+
+    SceneData::CameraChange cameraChange(const Change &c) const;
+    SceneData::LightChange lightChange(const Change &c) const;
+    SceneData::ModelChange modelChange(const Change &c) const;
+
+    size_t memoryUsage() const { return sizeof(*this) + m_arena.bytesReserved(); }
+
+private:
+    Q_DISABLE_COPY(CompactSceneData)
+
+    QByteArray string(int idx) const;
+    static int valueCount(EntityKind kind, int mask);
+    static int easingWords(const SceneData::ModelChange &ch);
+
+    SceneArena m_arena;
+
+    int m_cameraCount = 0;
+    int m_lightCount = 0;
+    int m_entityCount = 0;
+    int m_totalTime = 0;
+
+    const char *m_stringData = nullptr;
+    const quint32 *m_stringOffsets = nullptr; // ids first, then the unique filenames
+    const quint32 *m_sortedIds = nullptr; // entity indices sorted by kind, id and index, for lookups
+    const qint32 *m_parents = nullptr;
+    const qint32 *m_filenames = nullptr; // string index per entity, -1 if none
+
+    struct FrameRecord {
+        qint32 t;
+        quint32 offset; // in words from m_changes
+        quint32 count;
+    };
+    int m_frameCount = 0;
+    const FrameRecord *m_frames = nullptr;
+    const quint32 *m_changes = nullptr;
+};
+
+#endif
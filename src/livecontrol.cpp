@@ -0,0 +1,170 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "livecontrol.h"
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QSocketNotifier>
+#include <chrono>
+#include <cerrno>
+#include <unistd.h>
+
+Q_LOGGING_CATEGORY(lcLive, "rtscpl.live")
+
+qint64 LiveControl::timestamp()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LiveControl::LiveControl(const QString &source, QObject *parent)
+    : QObject(parent)
+{
+    LiveControlWorker *worker = new LiveControlWorker(source, &m_queue, &m_dropped);
+    worker->moveToThread(&m_thread);
+    QObject::connect(&m_thread, &QThread::started, worker, &LiveControlWorker::start);
+    QObject::connect(&m_thread, &QThread::finished, worker, &QObject::deleteLater);
+    m_thread.setObjectName(QStringLiteral("live control"));
+    m_thread.start();
+}
+
+LiveControl::~LiveControl()
+{
+    m_thread.quit();
+    m_thread.wait();
+}
+
+LiveControlWorker::LiveControlWorker(const QString &source, LiveCommandQueue *queue, std::atomic<int> *dropped)
+    : m_source(source),
+      m_queue(queue),
+      m_dropped(dropped)
+{
+}
+
+void LiveControlWorker::start()
+{
+    if (m_source == QLatin1String("-")) {
+        m_stdinNotifier = new QSocketNotifier(STDIN_FILENO, QSocketNotifier::Read, this);
+        QObject::connect(m_stdinNotifier, &QSocketNotifier::activated, this, &LiveControlWorker::readStdin);
+        qCDebug(lcLive, "Reading live commands from stdin");
+        return;
+    }
+
+    m_server = new QLocalServer(this);
+    QLocalServer::removeServer(m_source);
+    if (!m_server->listen(m_source)) {
+        qCWarning(lcLive, "Failed to listen on %s: %s", qPrintable(m_source), qPrintable(m_server->errorString()));
+        return;
+    }
+
+    QObject::connect(m_server, &QLocalServer::newConnection, this, [this] {
+        while (QLocalSocket *socket = m_server->nextPendingConnection()) {
+            QObject::connect(socket, &QLocalSocket::readyRead, this, [this, socket] {
+                while (socket->canReadLine())
+                    handleLine(socket->readLine());
+            });
+            // A last line without a newline.
+            QObject::connect(socket, &QLocalSocket::disconnected, this, [this, socket] {
+                if (socket->bytesAvailable())
+                    handleLine(socket->readAll());
+            });
+            QObject::connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+        }
+    });
+    qCDebug(lcLive, "Listening for live commands on %s", qPrintable(m_server->fullServerName()));
+}
+
+// Reads the fd directly: with a buffered reader, lines that arrive in one write
+// would wait in its buffer until the notifier fires again for more input.
+void LiveControlWorker::readStdin()
+{
+    char buf[4096];
+    const ssize_t n = ::read(STDIN_FILENO, buf, sizeof(buf));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+    if (n <= 0) {
+        if (n < 0)
+            qCWarning(lcLive, "Failed to read stdin");
+        m_stdinNotifier->setEnabled(false);
+        if (!m_stdinBuffer.isEmpty())
+            handleLine(m_stdinBuffer);
+        m_stdinBuffer.clear();
+        return;
+    }
+
+    m_stdinBuffer.append(buf, int(n));
+    int start = 0;
+    for (int nl = m_stdinBuffer.indexOf('\n'); nl >= 0; nl = m_stdinBuffer.indexOf('\n', start)) {
+        handleLine(m_stdinBuffer.mid(start, nl - start));
+        start = nl + 1;
+    }
+    m_stdinBuffer.remove(0, start);
+}
+
+void LiveControlWorker::handleLine(const QByteArray &line)
+{
+    const qint64 received = LiveControl::timestamp();
+
+    QByteArrayList c = line.simplified().split(' ');
+    if (c.count() < 2 || c[0].startsWith("//"))
+        return;
+
+    LiveCommand cmd;
+    cmd.id = c[0];
+    cmd.receivedNs = received;
+    QByteArray error;
+    if (!SceneParser::parseModelChange(c, &cmd.change, &error)) {
+        qCWarning(lcLive, "%s in '%s'", error.constData(), line.trimmed().constData());
+        return;
+    }
+
+    if (!m_queue->push(cmd))
+        ++*m_dropped;
+}
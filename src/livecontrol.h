@@ -0,0 +1,154 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef LIVECONTROL_H
+#define LIVECONTROL_H
+
+#include "twospaceparser.h"
+#include <QObject>
+#include <QThread>
+#include <QLoggingCategory>
+#include <atomic>
+
+Q_DECLARE_LOGGING_CATEGORY(lcLive)
+
+QT_BEGIN_NAMESPACE
+class QLocalServer;
+class QSocketNotifier;
+QT_END_NAMESPACE
+
+// Single producer, single consumer ring buffer. No locks: the producer only
+// writes the tail, the consumer only writes the head.
+template <typename T, int Capacity>
+class SpscQueue
+{
+public:
+    bool push(const T &v)
+    {
+        const int tail = m_tail.load(std::memory_order_relaxed);
+        const int next = (tail + 1) % Capacity;
+        if (next == m_head.load(std::memory_order_acquire))
+            return false; // full
+        m_slots[tail] = v;
+        m_tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T *v)
+    {
+        const int head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false; // empty
+        *v = m_slots[head];
+        m_slots[head] = T(); // release the payload on the consumer side
+        m_head.store((head + 1) % Capacity, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::atomic<int> m_head { 0 };
+    std::atomic<int> m_tail { 0 };
+    T m_slots[Capacity];
+};
+
+struct LiveCommand
+{
+    QByteArray id;
+    SceneData::ModelChange change;
+    qint64 receivedNs = 0; // LiveControl::timestamp() at receipt
+};
+
+typedef SpscQueue<LiveCommand, 4096> LiveCommandQueue;
+
+class LiveControlWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    LiveControlWorker(const QString &source, LiveCommandQueue *queue, std::atomic<int> *dropped);
+
+    void start();
+
+private:
+    void readStdin();
+    void handleLine(const QByteArray &line);
+
+    QString m_source;
+    LiveCommandQueue *m_queue;
+    std::atomic<int> *m_dropped;
+    QLocalServer *m_server = nullptr;
+    QSocketNotifier *m_stdinNotifier = nullptr;
+    QByteArray m_stdinBuffer; // the start of a line still being written
+};
+
+// Accepts keyframe-style model property lines, e.g. "block trans.x 2 color red",
+// from a local socket (or stdin when the source is "-", Unix only). Lines are
+// read and parsed on a worker thread and handed to the GUI thread through a
+// lock-free queue, which is drained once per frame.
+class LiveControl : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LiveControl(const QString &source, QObject *parent = nullptr);
+    ~LiveControl();
+
+    bool dequeue(LiveCommand *cmd) { return m_queue.pop(cmd); }
+    int takeDropped() { return m_dropped.exchange(0); }
+
+    static qint64 timestamp();
+
+private:
+    QThread m_thread;
+    LiveCommandQueue m_queue;
+    std::atomic<int> m_dropped { 0 };
+};
+
+#endif
@@ -54,19 +54,86 @@
 #include <Qt3DQuick/QQmlAspectEngine>
 #include <QQmlEngine>
 #include <QQmlContext>
+#include <QCommandLineParser>
+#include <QSurfaceFormat>
 #include "sceneplayer.h"
+#include "scenerecording.h"
+#include "scenetrace.h"
+
+static void addOptions(QCommandLineParser *parser)
+{
+    parser->addHelpOption();
+    parser->addOptions({
+        { "record", "Record the evaluated model transforms and colors to <file>.", "file" },
+        { "record-interval", "Recording interval in ms.", "ms", "20" },
+        { "replay", "Play back the recording in <file> instead of the animations.", "file" },
+        { "compare", "Compare two recordings given as arguments and report per-model deviations." },
+        { "tolerance", "Maximum deviation accepted by --compare.", "value", "0.001" },
+        { "scene", "Scene file to play.", "file", "test.2sp" },
+        { "playlist", "Comma separated scene files to play one after the other, in a loop.", "files" },
+        { "lighting", "Lighting path, forward or clustered.", "path", "forward" },
+        { "benchmark", "Log frame times over <seconds> of playback and quit.", "seconds" },
+        { "target-frame-time", "Lower the quality as needed to keep frame times around <ms>.", "ms" }
+    });
+    parser->addPositionalArgument("recordings", "With --compare, the two recordings to compare.", "[a b]");
+}
 
 int main(int argc, char* argv[])
 {
+    // Comparing recordings needs no window, so do not require a display for it.
+    for (int i = 1; i < argc; ++i) {
+        if (!qstrcmp(argv[i], "--compare")) {
+            QCoreApplication app(argc, argv);
+            QCommandLineParser parser;
+            addOptions(&parser);
+            parser.process(app);
+            const QStringList files = parser.positionalArguments();
+            if (files.count() != 2)
+                parser.showHelp(1);
+            const int failed = SceneRecording::compare(files[0], files[1], parser.value("tolerance").toFloat());
+            return failed == 0 ? 0 : 1;
+        }
+    }
+
     QGuiApplication app(argc, argv);
+    QCommandLineParser parser;
+    addOptions(&parser);
+    parser.process(app);
+
+    const QString lighting = parser.value("lighting");
+    if (lighting != QLatin1String("forward") && lighting != QLatin1String("clustered")) {
+        qWarning("Unknown lighting path %s", qPrintable(lighting));
+        return 1;
+    }
+    const int benchmark = parser.value("benchmark").toInt();
+    if (benchmark > 0) {
+        // Measure frame times, not the display's refresh rate.
+        QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+        format.setSwapInterval(0);
+        QSurfaceFormat::setDefaultFormat(format);
+    }
 
     qmlRegisterType<ScenePlayer>("rtscplq3t", 1, 0, "ScenePlayer");
 
     Qt3DExtras::Quick::Qt3DQuickWindow view;
     view.registerAspect(new Qt3DAnimation::QAnimationAspect);
-    view.engine()->qmlEngine()->rootContext()->setContextProperty("_window", &view);
+    QQmlContext *ctx = view.engine()->qmlEngine()->rootContext();
+    ctx->setContextProperty("_window", &view);
+    ctx->setContextProperty("_recordFile", parser.value("record"));
+    ctx->setContextProperty("_recordInterval", parser.value("record-interval").toInt());
+    ctx->setContextProperty("_replayFile", parser.value("replay"));
+    const QStringList playlist = parser.value("playlist").split(QLatin1Char(','), QString::SkipEmptyParts);
+    ctx->setContextProperty("_scene", playlist.isEmpty() ? parser.value("scene") : playlist.first());
+    ctx->setContextProperty("_playlist", playlist);
+    ctx->setContextProperty("_clusteredLighting", lighting == QLatin1String("clustered"));
+    ctx->setContextProperty("_benchmark", benchmark);
+    ctx->setContextProperty("_targetFrameTime", parser.value("target-frame-time").toDouble());
+    ctx->setContextProperty("_devicePixelRatio", view.devicePixelRatio());
+    QObject::connect(view.engine()->qmlEngine(), &QQmlEngine::quit, &app, &QCoreApplication::quit);
     view.setSource(QUrl("qrc:/main.qml"));
     view.show();
 
-    return app.exec();
+    const int r = app.exec();
+    TRACE_WRITE();
+    return r;
 }
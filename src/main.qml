@@ -59,6 +59,7 @@ Entity {
 
     components: [
         RenderSettings {
+            id: renderSettings
             activeFrameGraph: ForwardRenderer {
                 id: mainRenderer
                 clearColor: Qt.rgba(0, 0, 0, 1)
@@ -73,7 +74,17 @@ Entity {
 
     ScenePlayer {
         renderer: mainRenderer
+        renderSettings: renderSettings
         aspectRatio: _window.width / _window.height
-        source: "test.2sp"
+        source: _scene
+        playlist: _playlist
+        recordFile: _recordFile
+        recordInterval: _recordInterval
+        replayFile: _replayFile
+        clusteredLighting: _clusteredLighting
+        surfaceSize: Qt.size(_window.width * _devicePixelRatio, _window.height * _devicePixelRatio)
+        benchmark: _benchmark
+        targetFrameTime: _targetFrameTime
+        onBenchmarkFinished: Qt.quit()
     }
 }
@@ -0,0 +1,215 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "meshloader.h"
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <cmath>
+
+static int objIndex(const QByteArray &s, int count)
+{
+    bool ok = false;
+    const int i = s.toInt(&ok);
+    if (!ok || i == 0)
+        return -1;
+    return i > 0 ? i - 1 : count + i; // negative indices are relative to the end
+}
+
+bool loadObjMesh(const QString &fn, MeshData *mesh)
+{
+    QFile f(fn);
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning("Failed to open %s", qPrintable(fn));
+        return false;
+    }
+
+    QVector<QVector3D> positions;
+    QVector<QVector3D> normals;
+    QHash<QPair<int, int>, quint32> vertexMap; // (position, normal) -> vertex
+    mesh->positions.clear();
+    mesh->normals.clear();
+    mesh->indices.clear();
+    bool needsNormals = false;
+
+    int lineNumber = 0;
+    while (!f.atEnd()) {
+        const QByteArray line = f.readLine().simplified();
+        ++lineNumber;
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+
+        const QByteArrayList c = line.split(' ');
+        if (c[0] == QByteArrayLiteral("v") && c.count() >= 4) {
+            positions.append(QVector3D(c[1].toFloat(), c[2].toFloat(), c[3].toFloat()));
+        } else if (c[0] == QByteArrayLiteral("vn") && c.count() >= 4) {
+            normals.append(QVector3D(c[1].toFloat(), c[2].toFloat(), c[3].toFloat()));
+        } else if (c[0] == QByteArrayLiteral("f") && c.count() >= 4) {
+            QVector<quint32> face;
+            for (int i = 1; i < c.count(); ++i) {
+                // v, v/vt, v//vn or v/vt/vn
+                const QByteArrayList refs = c[i].split('/');
+                const int p = objIndex(refs[0], positions.count());
+                const int n = refs.count() >= 3 ? objIndex(refs[2], normals.count()) : -1;
+                if (p < 0 || p >= positions.count() || n >= normals.count()) {
+                    qWarning("%s:%d: Invalid face", qPrintable(fn), lineNumber);
+                    return false;
+                }
+                if (n < 0)
+                    needsNormals = true;
+                const QPair<int, int> key(p, n);
+                auto it = vertexMap.constFind(key);
+                if (it == vertexMap.constEnd()) {
+                    it = vertexMap.insert(key, quint32(mesh->positions.count()));
+                    mesh->positions.append(positions[p]);
+                    mesh->normals.append(n >= 0 ? normals[n] : QVector3D());
+                }
+                face.append(*it);
+            }
+            for (int i = 2; i < face.count(); ++i)
+                mesh->indices << face[0] << face[i - 1] << face[i];
+        }
+    }
+
+    if (needsNormals) {
+        // Area weighted face normals accumulated on the vertices that have none.
+        QVector<QVector3D> generated(mesh->positions.count());
+        for (int i = 0; i + 2 < mesh->indices.count(); i += 3) {
+            const quint32 a = mesh->indices[i], b = mesh->indices[i + 1], c = mesh->indices[i + 2];
+            const QVector3D n = QVector3D::crossProduct(mesh->positions[b] - mesh->positions[a],
+                                                        mesh->positions[c] - mesh->positions[a]);
+            generated[a] += n;
+            generated[b] += n;
+            generated[c] += n;
+        }
+        for (int i = 0; i < mesh->normals.count(); ++i) {
+            if (mesh->normals[i].isNull())
+                mesh->normals[i] = generated[i].normalized();
+        }
+    }
+
+    return true;
+}
+
+float objBoundingRadius(const QString &fn)
+{
+    QFile f(fn);
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning("Failed to open %s", qPrintable(fn));
+        return 0;
+    }
+
+    float radiusSquared = 0;
+    while (!f.atEnd()) {
+        const QByteArray line = f.readLine();
+        if (!line.startsWith("v "))
+            continue;
+        const QByteArrayList c = line.simplified().split(' ');
+        if (c.count() >= 4)
+            radiusSquared = qMax(radiusSquared, QVector3D(c[1].toFloat(), c[2].toFloat(), c[3].toFloat()).lengthSquared());
+    }
+    return std::sqrt(radiusSquared);
+}
+
+QVector<MergedGeometry> mergeStaticMeshes(const QVector<StaticMeshInstance> &instances)
+{
+    QHash<QString, MeshData> meshes;
+    QMap<QRgb, MergedGeometry> groups; // ordered for deterministic output
+
+    for (const StaticMeshInstance &inst : instances) {
+        auto mit = meshes.find(inst.filename);
+        if (mit == meshes.end()) {
+            MeshData mesh;
+            if (!loadObjMesh(QLatin1String(":/") + inst.filename, &mesh))
+                qWarning("Static model %s could not be merged", qPrintable(inst.filename));
+            mit = meshes.insert(inst.filename, mesh);
+        }
+        const MeshData &mesh(*mit);
+        if (mesh.isEmpty())
+            continue;
+
+        MergedGeometry &g(groups[inst.color.rgba()]);
+        g.color = inst.color;
+        ++g.sourceCount;
+
+        const quint32 base = quint32(g.vertexCount);
+        const QMatrix3x3 normalMatrix = inst.world.normalMatrix();
+        const int vertexOffset = g.vertexData.size();
+        g.vertexData.resize(vertexOffset + mesh.positions.count() * 6 * int(sizeof(float)));
+        float *v = reinterpret_cast<float *>(g.vertexData.data() + vertexOffset);
+        for (int i = 0; i < mesh.positions.count(); ++i) {
+            const QVector3D p = inst.world * mesh.positions[i];
+            const QVector3D &n(mesh.normals[i]);
+            const QVector3D wn = QVector3D(normalMatrix(0, 0) * n.x() + normalMatrix(0, 1) * n.y() + normalMatrix(0, 2) * n.z(),
+                                           normalMatrix(1, 0) * n.x() + normalMatrix(1, 1) * n.y() + normalMatrix(1, 2) * n.z(),
+                                           normalMatrix(2, 0) * n.x() + normalMatrix(2, 1) * n.y() + normalMatrix(2, 2) * n.z()).normalized();
+            *v++ = p.x();
+            *v++ = p.y();
+            *v++ = p.z();
+            *v++ = wn.x();
+            *v++ = wn.y();
+            *v++ = wn.z();
+        }
+        g.vertexCount += mesh.positions.count();
+
+        const int indexOffset = g.indexData.size();
+        g.indexData.resize(indexOffset + mesh.indices.count() * int(sizeof(quint32)));
+        quint32 *idx = reinterpret_cast<quint32 *>(g.indexData.data() + indexOffset);
+        for (quint32 i : mesh.indices)
+            *idx++ = base + i;
+        g.indexCount += mesh.indices.count();
+    }
+
+    QVector<MergedGeometry> result;
+    result.reserve(groups.count());
+    for (const MergedGeometry &g : groups)
+        result.append(g);
+    return result;
+}
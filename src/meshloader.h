@@ -0,0 +1,100 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef MESHLOADER_H
+#define MESHLOADER_H
+
+#include <QVector>
+#include <QVector3D>
+#include <QMatrix4x4>
+#include <QColor>
+
+// Triangle mesh on the CPU side, with one normal per vertex.
+struct MeshData
+{
+    QVector<QVector3D> positions;
+    QVector<QVector3D> normals;
+    QVector<quint32> indices;
+
+    bool isEmpty() const { return indices.isEmpty(); }
+};
+
+// Minimal Wavefront OBJ reader: v, vn and f (polygons are triangulated as fans).
+// Texture coordinates and materials are ignored. Missing normals are generated
+// per face.
+bool loadObjMesh(const QString &fn, MeshData *mesh);
+
+// Radius of the smallest origin-centered sphere around the OBJ's vertices, or 0
+// when the file cannot be read. Only reads the v lines.
+float objBoundingRadius(const QString &fn);
+
+struct StaticMeshInstance
+{
+    QString filename;
+    QMatrix4x4 world;
+    QColor color;
+};
+
+// Interleaved position + normal vertices (6 floats) with 32-bit indices.
+struct MergedGeometry
+{
+    QColor color;
+    QByteArray vertexData;
+    QByteArray indexData;
+    int vertexCount = 0;
+    int indexCount = 0;
+    int sourceCount = 0; // number of instances merged into this one
+};
+
+// Transforms the meshes into world space and concatenates them, one geometry
+// per distinct color. Meshes are loaded once per file. Safe to call on any thread.
+QVector<MergedGeometry> mergeStaticMeshes(const QVector<StaticMeshInstance> &instances);
+
+#endif
@@ -0,0 +1,368 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "meshoptimizer.h"
+#include <QHash>
+#include <qfloat16.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+void weldVertices(MeshData *mesh)
+{
+    QHash<QByteArray, quint32> unique;
+    QVector<quint32> remap(mesh->positions.count());
+    QVector<QVector3D> positions;
+    QVector<QVector3D> normals;
+    for (int i = 0; i < mesh->positions.count(); ++i) {
+        const float key[6] = { mesh->positions[i].x(), mesh->positions[i].y(), mesh->positions[i].z(),
+                               mesh->normals[i].x(), mesh->normals[i].y(), mesh->normals[i].z() };
+        auto it = unique.find(QByteArray(reinterpret_cast<const char *>(key), sizeof(key)));
+        if (it == unique.end()) {
+            it = unique.insert(QByteArray(reinterpret_cast<const char *>(key), sizeof(key)), quint32(positions.count()));
+            positions.append(mesh->positions[i]);
+            normals.append(mesh->normals[i]);
+        }
+        remap[i] = it.value();
+    }
+    for (quint32 &i : mesh->indices)
+        i = remap[i];
+    mesh->positions = positions;
+    mesh->normals = normals;
+}
+
+// Scoring from Forsyth's "Linear-Speed Vertex Cache Optimisation".
+static const int ForsythCacheSize = 32;
+
+static float forsythVertexScore(int cachePosition, int remainingTriangles)
+{
+    if (remainingTriangles == 0)
+        return -1;
+
+    float score = 0;
+    if (cachePosition >= 0) {
+        // The vertices of the last triangle get a fixed score so that the next
+        // triangle does not simply reuse its edge.
+        if (cachePosition < 3)
+            score = 0.75f;
+        else
+            score = std::pow(1.0f - (cachePosition - 3) / float(ForsythCacheSize - 3), 1.5f);
+    }
+    // Prefer vertices with few triangles left, to finish them off.
+    score += 2.0f * std::pow(float(remainingTriangles), -0.5f);
+    return score;
+}
+
+void optimizeVertexCache(MeshData *mesh)
+{
+    const QVector<quint32> &indices(mesh->indices);
+    const int triangleCount = indices.count() / 3;
+    const int vertexCount = mesh->positions.count();
+    if (triangleCount == 0)
+        return;
+
+    // Triangles of each vertex; the first remaining[v] entries are not emitted yet.
+    QVector<int> remaining(vertexCount, 0);
+    for (quint32 i : indices)
+        ++remaining[i];
+    QVector<int> offsets(vertexCount + 1, 0);
+    for (int v = 0; v < vertexCount; ++v)
+        offsets[v + 1] = offsets[v] + remaining[v];
+    QVector<int> adjacency(indices.count());
+    QVector<int> fill(offsets);
+    for (int i = 0; i < indices.count(); ++i)
+        adjacency[fill[indices[i]]++] = i / 3;
+
+    QVector<int> cachePosition(vertexCount, -1);
+    QVector<float> vertexScore(vertexCount);
+    for (int v = 0; v < vertexCount; ++v)
+        vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+    QVector<float> triangleScore(triangleCount);
+    for (int t = 0; t < triangleCount; ++t)
+        triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+    QVector<bool> emitted(triangleCount, false);
+
+    QVector<quint32> result;
+    result.reserve(indices.count());
+    QVector<int> cache;
+    QVector<int> newCache;
+    cache.reserve(ForsythCacheSize + 3);
+    newCache.reserve(ForsythCacheSize + 3);
+    int best = int(std::max_element(triangleScore.cbegin(), triangleScore.cend()) - triangleScore.cbegin());
+    int scan = 0; // no triangle before this one is left
+
+    for (int n = 0; n < triangleCount; ++n) {
+        if (best < 0) {
+            // Nothing touching the cache is left; continue with the next triangle in the input.
+            while (emitted[scan])
+                ++scan;
+            best = scan;
+        }
+
+        emitted[best] = true;
+        newCache.clear();
+        for (int k = 0; k < 3; ++k) {
+            const int v = int(indices[3 * best + k]);
+            result.append(quint32(v));
+            int *tris = adjacency.data() + offsets[v];
+            std::swap(*std::find(tris, tris + remaining[v], best), tris[remaining[v] - 1]);
+            --remaining[v];
+            if (!newCache.contains(v))
+                newCache.append(v);
+        }
+        for (int v : qAsConst(cache)) {
+            if (!newCache.contains(v))
+                newCache.append(v);
+        }
+        cache.swap(newCache);
+
+        // Rescore the vertices whose cache position changed, including the ones
+        // that just fell out, and with them their remaining triangles.
+        best = -1;
+        float bestScore = -1;
+        for (int i = 0; i < cache.count(); ++i) {
+            const int v = cache[i];
+            cachePosition[v] = i < ForsythCacheSize ? i : -1;
+            const float score = forsythVertexScore(cachePosition[v], remaining[v]);
+            const float delta = score - vertexScore[v];
+            vertexScore[v] = score;
+            for (int j = 0; j < remaining[v]; ++j) {
+                const int t = adjacency[offsets[v] + j];
+                triangleScore[t] += delta;
+                if (triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+        if (cache.count() > ForsythCacheSize)
+            cache.resize(ForsythCacheSize);
+    }
+
+    mesh->indices = result;
+}
+
+float averageCacheMissRatio(const QVector<quint32> &indices, int vertexCount, int cacheSize)
+{
+    if (indices.isEmpty())
+        return 0;
+
+    // A vertex is in the FIFO while fewer than cacheSize misses happened since it went in.
+    QVector<int> insertedAt(vertexCount, INT_MIN / 2);
+    int misses = 0;
+    for (quint32 i : indices) {
+        if (misses - insertedAt[int(i)] >= cacheSize)
+            insertedAt[int(i)] = misses++;
+    }
+    return misses / float(indices.count() / 3);
+}
+
+void optimizeOverdraw(MeshData *mesh, float threshold)
+{
+    const QVector<quint32> &indices(mesh->indices);
+    const int triangleCount = indices.count() / 3;
+    if (triangleCount < 2)
+        return;
+
+    // Cut the triangle order into clusters where the cache simulation shows a
+    // jump, a triangle with all three vertices missing.
+    static const int CacheSize = 16;
+    static const int MinClusterSize = 16; // triangles
+    struct Cluster {
+        int start;
+        int end;
+        QVector3D centroid;
+        QVector3D normal;
+        float sortKey;
+    };
+    QVector<Cluster> clusters;
+    QVector<int> insertedAt(mesh->positions.count(), INT_MIN / 2);
+    int misses = 0;
+    int start = 0;
+    for (int t = 0; t < triangleCount; ++t) {
+        int triangleMisses = 0;
+        for (int k = 0; k < 3; ++k) {
+            const int v = int(indices[3 * t + k]);
+            if (misses - insertedAt[v] >= CacheSize) {
+                insertedAt[v] = misses++;
+                ++triangleMisses;
+            }
+        }
+        if (triangleMisses == 3 && t - start >= MinClusterSize) {
+            clusters.append({ start, t, QVector3D(), QVector3D(), 0 });
+            start = t;
+        }
+    }
+    clusters.append({ start, triangleCount, QVector3D(), QVector3D(), 0 });
+    if (clusters.count() < 2)
+        return;
+
+    // Clusters facing away from the middle of the mesh are more likely to cover
+    // others than to be covered, so they go first.
+    QVector3D meshCentroid;
+    float meshArea = 0;
+    for (Cluster &c : clusters) {
+        float area = 0;
+        for (int t = c.start; t < c.end; ++t) {
+            const QVector3D &a(mesh->positions[int(indices[3 * t])]);
+            const QVector3D &b(mesh->positions[int(indices[3 * t + 1])]);
+            const QVector3D &d(mesh->positions[int(indices[3 * t + 2])]);
+            const QVector3D n = QVector3D::crossProduct(b - a, d - a); // length is twice the area
+            const float triangleArea = n.length();
+            c.centroid += (a + b + d) / 3 * triangleArea;
+            c.normal += n;
+            area += triangleArea;
+        }
+        meshCentroid += c.centroid;
+        meshArea += area;
+        if (area > 0)
+            c.centroid /= area;
+    }
+    if (meshArea <= 0)
+        return;
+    meshCentroid /= meshArea;
+    for (Cluster &c : clusters)
+        c.sortKey = QVector3D::dotProduct(c.centroid - meshCentroid, c.normal.normalized());
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b) {
+        return a.sortKey > b.sortKey;
+    });
+
+    QVector<quint32> result;
+    result.reserve(indices.count());
+    for (const Cluster &c : qAsConst(clusters))
+        result.append(indices.mid(3 * c.start, 3 * (c.end - c.start)));
+
+    const int vertexCount = mesh->positions.count();
+    if (averageCacheMissRatio(result, vertexCount) <= averageCacheMissRatio(indices, vertexCount) * threshold)
+        mesh->indices = result;
+}
+
+void optimizeVertexFetch(MeshData *mesh)
+{
+    QVector<int> remap(mesh->positions.count(), -1);
+    QVector<QVector3D> positions;
+    QVector<QVector3D> normals;
+    positions.reserve(mesh->positions.count());
+    normals.reserve(mesh->normals.count());
+    for (quint32 &i : mesh->indices) {
+        int &r(remap[int(i)]);
+        if (r < 0) {
+            r = positions.count();
+            positions.append(mesh->positions[int(i)]);
+            normals.append(mesh->normals[int(i)]);
+        }
+        i = quint32(r);
+    }
+    mesh->positions = positions; // unreferenced vertices are dropped
+    mesh->normals = normals;
+}
+
+static OptimizedMesh packMesh(const MeshData &mesh, bool quantize)
+{
+    OptimizedMesh result;
+    result.vertexCount = mesh.positions.count();
+    result.indexCount = mesh.indices.count();
+    result.halfNormals = quantize;
+    result.shortIndices = result.vertexCount <= 0xFFFF;
+
+    result.vertexData.resize(result.vertexCount * result.vertexStride());
+    char *v = result.vertexData.data();
+    for (int i = 0; i < result.vertexCount; ++i) {
+        const float p[3] = { mesh.positions[i].x(), mesh.positions[i].y(), mesh.positions[i].z() };
+        memcpy(v, p, sizeof(p));
+        const QVector3D &n(mesh.normals[i]);
+        if (quantize) {
+            const qfloat16 h[4] = { qfloat16(n.x()), qfloat16(n.y()), qfloat16(n.z()), qfloat16(0.0f) };
+            memcpy(v + sizeof(p), h, sizeof(h));
+        } else {
+            const float f[3] = { n.x(), n.y(), n.z() };
+            memcpy(v + sizeof(p), f, sizeof(f));
+        }
+        v += result.vertexStride();
+    }
+
+    if (result.shortIndices) {
+        result.indexData.resize(result.indexCount * int(sizeof(quint16)));
+        quint16 *idx = reinterpret_cast<quint16 *>(result.indexData.data());
+        for (quint32 i : mesh.indices)
+            *idx++ = quint16(i);
+    } else {
+        result.indexData = QByteArray(reinterpret_cast<const char *>(mesh.indices.constData()),
+                                      result.indexCount * int(sizeof(quint32)));
+    }
+    return result;
+}
+
+OptimizedMesh loadOptimizedMesh(const QString &fn, bool quantize)
+{
+    MeshData mesh;
+    if (!loadObjMesh(fn, &mesh) || mesh.isEmpty())
+        return OptimizedMesh();
+
+    // As loaded: float positions and normals with 32-bit indices, in file order.
+    const int triangleCount = mesh.indices.count() / 3;
+    const int loadedVertices = mesh.positions.count();
+    const int loadedBytes = loadedVertices * 6 * int(sizeof(float)) + mesh.indices.count() * int(sizeof(quint32));
+    const float acmrBefore = averageCacheMissRatio(mesh.indices, loadedVertices);
+
+    weldVertices(&mesh);
+    optimizeVertexCache(&mesh);
+    optimizeOverdraw(&mesh);
+    optimizeVertexFetch(&mesh);
+    const OptimizedMesh result = packMesh(mesh, quantize);
+
+    const float acmrAfter = averageCacheMissRatio(mesh.indices, result.vertexCount);
+    const int optimizedBytes = result.vertexData.size() + result.indexData.size();
+    qDebug("%s: %d triangles, %d -> %d vertices, ACMR %.3f -> %.3f (%d -> %d vertex shader invocations), %d -> %d bytes",
+           qPrintable(fn), triangleCount, loadedVertices, result.vertexCount, acmrBefore, acmrAfter,
+           qRound(acmrBefore * triangleCount), qRound(acmrAfter * triangleCount), loadedBytes, optimizedBytes);
+    return result;
+}
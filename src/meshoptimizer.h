@@ -0,0 +1,96 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include "meshloader.h"
+
+// Import-time optimizations for meshes read with loadObjMesh(). All of them keep
+// the rendered result the same and only change the order and the encoding.
+
+// Merges vertices with bitwise identical positions and normals.
+void weldVertices(MeshData *mesh);
+
+// Reorders the triangles for the post-transform vertex cache, using Tom
+// Forsyth's linear-speed vertex cache optimisation.
+void optimizeVertexCache(MeshData *mesh);
+
+// Reorders clusters of cache-ordered triangles so that the ones facing outwards
+// come first and occlude the rest, as long as the average cache miss ratio does
+// not grow by more than threshold (1.05 = 5%).
+void optimizeOverdraw(MeshData *mesh, float threshold = 1.05f);
+
+// Renumbers the vertices in the order the indices first use them.
+void optimizeVertexFetch(MeshData *mesh);
+
+// Average number of vertex shader invocations per triangle with a FIFO
+// post-transform cache of cacheSize vertices.
+float averageCacheMissRatio(const QVector<quint32> &indices, int vertexCount, int cacheSize = 16);
+
+struct OptimizedMesh
+{
+    // Position as 3 floats, then the normal as 3 floats, or with halfNormals as 3
+    // half floats padded to 8 bytes.
+    QByteArray vertexData;
+    QByteArray indexData; // 16-bit when shortIndices, 32-bit otherwise
+    int vertexCount = 0;
+    int indexCount = 0;
+    bool halfNormals = false;
+    bool shortIndices = false;
+
+    int vertexStride() const { return halfNormals ? 20 : 24; }
+};
+
+// Loads, welds, reorders and packs an OBJ asset and logs what it saves against
+// the mesh as loaded. Safe to call on any thread.
+OptimizedMesh loadOptimizedMesh(const QString &fn, bool quantize);
+
+#endif
@@ -0,0 +1,118 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "multiviewrenderer.h"
+#include "clusteredlighting.h"
+#include <Qt3DRender/QCamera>
+#include <Qt3DRender/QCameraSelector>
+#include <Qt3DRender/QClearBuffers>
+#include <Qt3DRender/QFilterKey>
+#include <Qt3DRender/QFrustumCulling>
+#include <Qt3DRender/QNoDraw>
+#include <Qt3DRender/QParameter>
+#include <Qt3DRender/QTechniqueFilter>
+#include <Qt3DRender/QViewport>
+#include <QtMath>
+
+MultiViewRenderer::MultiViewRenderer(Qt3DCore::QNode *parent)
+    : Qt3DRender::QRenderSurfaceSelector(parent)
+{
+    // The whole surface is cleared once, then each view draws into its part.
+    m_viewport = new Qt3DRender::QViewport(this);
+    m_clearBuffers = new Qt3DRender::QClearBuffers(m_viewport);
+    m_clearBuffers->setBuffers(Qt3DRender::QClearBuffers::ColorDepthBuffer);
+    m_clearBuffers->setClearColor(Qt::black);
+    new Qt3DRender::QNoDraw(m_clearBuffers);
+}
+
+void MultiViewRenderer::setViews(const QVector<Qt3DRender::QCamera *> &cameras, ClusteredLighting *lighting)
+{
+    qDeleteAll(m_views);
+    m_views.clear();
+
+    for (int i = 0; i < cameras.count(); ++i) {
+        Qt3DRender::QViewport *viewport = new Qt3DRender::QViewport(m_viewport);
+        viewport->setNormalizedRect(viewRect(i, cameras.count()));
+        Qt3DRender::QCameraSelector *cameraSelector = new Qt3DRender::QCameraSelector(viewport);
+        cameraSelector->setCamera(cameras[i]);
+        Qt3DRender::QFrustumCulling *culling = new Qt3DRender::QFrustumCulling(cameraSelector);
+        Qt3DRender::QTechniqueFilter *techniqueFilter = new Qt3DRender::QTechniqueFilter(culling);
+        Qt3DRender::QFilterKey *filterKey = new Qt3DRender::QFilterKey;
+        filterKey->setName(QStringLiteral("renderingStyle"));
+        filterKey->setValue(QStringLiteral("forward"));
+        techniqueFilter->addMatch(filterKey);
+        if (lighting && i < lighting->viewCount()) {
+            for (Qt3DRender::QParameter *p : lighting->viewParameters(i))
+                techniqueFilter->addParameter(p);
+        }
+        m_views.append(viewport);
+    }
+}
+
+QColor MultiViewRenderer::clearColor() const
+{
+    return m_clearBuffers->clearColor();
+}
+
+void MultiViewRenderer::setClearColor(const QColor &color)
+{
+    m_clearBuffers->setClearColor(color);
+}
+
+QRectF MultiViewRenderer::viewRect(int view, int count)
+{
+    // As square a grid as possible, filled row by row.
+    const int columns = qCeil(qSqrt(qreal(count)));
+    const int rows = (count + columns - 1) / columns;
+    const qreal w = 1.0 / columns;
+    const qreal h = 1.0 / rows;
+    return QRectF((view % columns) * w, (view / columns) * h, w, h);
+}
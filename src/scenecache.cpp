@@ -0,0 +1,156 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "scenecache.h"
+#include "scenetrace.h"
+#include <QtConcurrentRun>
+#include <QFileInfo>
+#include <QDateTime>
+#include <climits>
+
+SceneCache *SceneCache::instance()
+{
+    static SceneCache cache;
+    return &cache;
+}
+
+SceneCache::SceneCache()
+{
+    setMaxMemory(64 * 1024 * 1024);
+}
+
+QString SceneCache::cacheKey(const QString &fn)
+{
+    const QFileInfo fi(fn);
+    return fi.absoluteFilePath() + QLatin1Char('@') + QString::number(fi.lastModified().toMSecsSinceEpoch());
+}
+
+bool SceneCache::includesUnchanged(const SceneData &sd)
+{
+    for (const QString &key : sd.includes) {
+        if (cacheKey(key.left(key.lastIndexOf(QLatin1Char('@')))) != key)
+            return false;
+    }
+    return true;
+}
+
+QFuture<SceneData> SceneCache::load(const QString &fn)
+{
+    TRACE_SCOPE_ARG("SceneCache::load", "file", fn.toUtf8());
+    const QString key = cacheKey(fn);
+
+    QMutexLocker lock(&m_lock);
+
+    if (SceneData *sd = m_scenes.object(key)) {
+        if (includesUnchanged(*sd)) {
+            QFutureInterface<SceneData> fi;
+            fi.reportStarted();
+            fi.reportResult(*sd);
+            fi.reportFinished();
+            return fi.future();
+        }
+        m_scenes.remove(key);
+    }
+
+    auto it = m_inFlight.constFind(key);
+    if (it != m_inFlight.cend())
+        return it.value();
+
+    QFuture<SceneData> future = QtConcurrent::run([this, fn, key]() {
+        const SceneData sd = SceneParser::parse(fn);
+        QMutexLocker lock(&m_lock);
+        // Moving from in-flight to cached under one lock leaves no window for a duplicate parse.
+        m_inFlight.remove(key);
+        if (sd.isValid())
+            m_scenes.insert(key, new SceneData(sd), int(qMax<size_t>(sd.memoryUsage() / 1024, 1)));
+        return sd;
+    });
+    m_inFlight.insert(key, future);
+    return future;
+}
+
+SceneSource SceneCache::source(const QString &fn)
+{
+    const QString key = cacheKey(fn);
+    {
+        QMutexLocker lock(&m_lock);
+        if (SceneSource *src = m_sources.object(key))
+            return *src;
+    }
+
+    // Not joined like whole scenes: two scenes sharing an include rarely load at once.
+    SceneSource src = SceneParser::tokenize(fn);
+    src.key = key;
+    if (src.isValid()) {
+        QMutexLocker lock(&m_lock);
+        m_sources.insert(key, new SceneSource(src), int(qMax<size_t>(src.memoryUsage() / 1024, 1)));
+    }
+    return src;
+}
+
+size_t SceneCache::maxMemory() const
+{
+    QMutexLocker lock(&m_lock);
+    return size_t(m_scenes.maxCost()) * 1024;
+}
+
+void SceneCache::setMaxMemory(size_t bytes)
+{
+    QMutexLocker lock(&m_lock);
+    m_scenes.setMaxCost(int(qMin<size_t>(bytes / 1024, INT_MAX)));
+    m_sources.setMaxCost(m_scenes.maxCost() / 4);
+}
+
+void SceneCache::clear()
+{
+    QMutexLocker lock(&m_lock);
+    m_scenes.clear();
+    m_sources.clear();
+}
@@ -0,0 +1,87 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef SCENECACHE_H
+#define SCENECACHE_H
+
+#include "twospaceparser.h"
+#include <QCache>
+#include <QMutex>
+
+// Process-wide cache of parsed scenes, keyed by absolute path and modification
+// time. SceneData is implicitly shared, so all users of a cached scene share
+// one copy. Concurrent loads of the same file wait for the same parse. The
+// least recently used scenes are evicted when the memory cap is exceeded.
+// Included files are cached as tokenized sources, within a quarter of the cap,
+// and a cached scene is only used while none of its includes has changed.
+class SceneCache
+{
+public:
+    static SceneCache *instance();
+
+    QFuture<SceneData> load(const QString &fn);
+    SceneSource source(const QString &fn); // synchronous
+
+    size_t maxMemory() const;
+    void setMaxMemory(size_t bytes);
+    void clear();
+
+private:
+    SceneCache();
+    static QString cacheKey(const QString &fn);
+    static bool includesUnchanged(const SceneData &sd);
+
+    mutable QMutex m_lock;
+    QCache<QString, SceneData> m_scenes; // cost is in KB
+    QCache<QString, SceneSource> m_sources; // cost is in KB
+    QHash<QString, QFuture<SceneData> > m_inFlight;
+};
+
+#endif
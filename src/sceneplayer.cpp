@@ -49,9 +49,16 @@
 ****************************************************************************/
 
 #include "sceneplayer.h"
+#include "livecontrol.h"
+#include "clusteredlighting.h"
+#include "meshoptimizer.h"
+#include "multiviewrenderer.h"
+#include "scenecache.h"
+#include "scenetrace.h"
 #include <Qt3DCore/QTransform>
 #include <Qt3DRender/QCamera>
 #include <Qt3DRender/QDirectionalLight>
+#include <Qt3DRender/QPointLight>
 #include <Qt3DRender/QMesh>
 #include <Qt3DExtras/QForwardRenderer>
 #include <Qt3DExtras/QPhongMaterial>
@@ -59,163 +66,1916 @@
 #include <Qt3DAnimation/QChannelMapper>
 #include <Qt3DAnimation/QChannelMapping>
 #include <Qt3DAnimation/QAnimationClip>
+#include <Qt3DAnimation/QClock>
+#include <Qt3DLogic/QFrameAction>
+#include <Qt3DRender/QGeometryRenderer>
+#include <Qt3DRender/QGeometry>
+#include <Qt3DRender/QBuffer>
+#include <Qt3DRender/QAttribute>
+#include <Qt3DRender/QRenderSettings>
+#include <Qt3DRender/QLevelOfDetail>
+#include <Qt3DRender/QLevelOfDetailBoundingSphere>
+#include <QtConcurrent>
+#include <QtMath>
+#include <algorithm>
+#include <numeric>
+#include <limits>
 
 ScenePlayer::ScenePlayer(QNode *parent)
     : Qt3DCore::QEntity(parent),
-      m_parser(new SceneParser)
+      m_parser(new SceneParser),
+      m_clock(new Qt3DAnimation::QClock(this)),
+      m_frameAction(new Qt3DLogic::QFrameAction)
 {
+    QObject::connect(m_frameAction, &Qt3DLogic::QFrameAction::triggered, this, &ScenePlayer::onFrame);
+    QObject::connect(&m_mergeWatcher, &QFutureWatcherBase::finished, this, &ScenePlayer::addMergedGeometry);
+    QObject::connect(&m_indexWatcher, &QFutureWatcherBase::finished, this, &ScenePlayer::onIndexReady);
+    QObject::connect(&m_windowWatcher, &QFutureWatcherBase::finished, this, &ScenePlayer::onWindowBuilt);
+    QObject::connect(&m_watcher, &QFutureWatcherBase::finished, this, [this] {
+        setupScene(m_watcher.result());
+    });
+    QObject::connect(&m_prefetchWatcher, &QFutureWatcherBase::finished, this, &ScenePlayer::onPrefetchParsed);
+    QObject::connect(&m_clipsWatcher, &QFutureWatcherBase::finished, this, &ScenePlayer::onPrefetchClipsBuilt);
+    m_wakeTimer.setSingleShot(true);
+    QObject::connect(&m_wakeTimer, &QTimer::timeout, this, &ScenePlayer::onWake);
+    addComponent(m_frameAction);
+}
+
+ScenePlayer::~ScenePlayer()
+{
+}
+
+void ScenePlayer::setLiveSource(const QString &source)
+{
+    if (m_liveSource == source)
+        return;
+
+    m_liveSource = source;
+    m_liveControl.reset(source.isEmpty() ? nullptr : new LiveControl(source));
+    m_liveCount = 0;
+    m_liveLatencySum = m_liveLatencyPeak = 0;
+    m_liveStatsTimer.start();
+}
+
+void ScenePlayer::applyLiveChanges()
+{
+    LiveCommand cmd;
+    while (m_liveControl->dequeue(&cmd)) {
+        auto it = m_scene.modelNodes.find(cmd.id);
+        if (it == m_scene.modelNodes.end()) {
+            qCWarning(lcLive, "Unknown or not instantiated model %s", cmd.id.constData());
+            continue;
+        }
+
+        // Live control takes over from the clip for good.
+        if (it->animator) {
+            it->animator->setRunning(false);
+            m_scene.animators.removeOne(it->animator);
+            m_scene.suspendedAnimators.remove(it->animator);
+            it->animator = nullptr;
+        }
+
+        applyModelChange(it->components, cmd.change);
+        if ((cmd.change.change & SceneData::ModelChange::Visible) && it->entity)
+            setEntityShown(it->entity, cmd.change.visible);
+
+        const qint64 latency = LiveControl::timestamp() - cmd.receivedNs;
+        m_liveLatencySum += latency;
+        m_liveLatencyPeak = qMax(m_liveLatencyPeak, latency);
+        ++m_liveCount;
+    }
+
+    if (m_liveStatsTimer.elapsed() >= 1000) {
+        const int dropped = m_liveControl->takeDropped();
+        m_liveLatency = m_liveCount ? m_liveLatencySum / qreal(m_liveCount) / 1000000.0 : 0;
+        m_liveLatencyMax = m_liveLatencyPeak / 1000000.0;
+        if (m_liveCount || dropped) {
+            qCDebug(lcLive, "%d changes applied, latency avg %.3f ms max %.3f ms, %d dropped",
+                    m_liveCount, m_liveLatency, m_liveLatencyMax, dropped);
+        }
+        m_liveCount = 0;
+        m_liveLatencySum = m_liveLatencyPeak = 0;
+        m_liveStatsTimer.start();
+        emit liveLatencyChanged();
+    }
+}
+
+// Both material types have a diffuse color.
+static QColor materialDiffuse(Qt3DRender::QMaterial *material)
+{
+    if (ClusteredLightMaterial *m = qobject_cast<ClusteredLightMaterial *>(material))
+        return m->diffuse();
+    return static_cast<Qt3DExtras::QPhongMaterial *>(material)->diffuse();
+}
+
+static void setMaterialDiffuse(Qt3DRender::QMaterial *material, const QColor &color)
+{
+    if (ClusteredLightMaterial *m = qobject_cast<ClusteredLightMaterial *>(material))
+        m->setDiffuse(color);
+    else
+        static_cast<Qt3DExtras::QPhongMaterial *>(material)->setDiffuse(color);
+}
+
+Qt3DRender::QMaterial *ScenePlayer::createMaterial(Scene *scene, Qt3DCore::QNode *parent)
+{
+    if (scene->lighting)
+        return new ClusteredLightMaterial(scene->lighting, parent);
+    return new Qt3DExtras::QPhongMaterial(parent);
+}
+
+void ScenePlayer::applyModelChange(const ModelComponents &mc, const SceneData::ModelChange &ch)
+{
+    Qt3DCore::QTransform *t = mc.transform;
+
+    if (ch.change & SceneData::ModelChange::Translation) {
+        QVector3D v = t->translation();
+        if (ch.change & SceneData::ModelChange::TranslationX)
+            v.setX(ch.translation.x());
+        if (ch.change & SceneData::ModelChange::TranslationY)
+            v.setY(ch.translation.y());
+        if (ch.change & SceneData::ModelChange::TranslationZ)
+            v.setZ(ch.translation.z());
+        t->setTranslation(v);
+    }
+
+    if (ch.change & SceneData::ModelChange::Rotation) {
+        QVector3D r = t->rotation().toEulerAngles();
+        if (ch.change & SceneData::ModelChange::RotationX)
+            r.setX(ch.rotation.x());
+        if (ch.change & SceneData::ModelChange::RotationY)
+            r.setY(ch.rotation.y());
+        if (ch.change & SceneData::ModelChange::RotationZ)
+            r.setZ(ch.rotation.z());
+        t->setRotation(QQuaternion::fromEulerAngles(r));
+    }
+
+    if (ch.change & SceneData::ModelChange::Scale) {
+        QVector3D v = t->scale3D();
+        if (ch.change & SceneData::ModelChange::ScaleX)
+            v.setX(ch.scale.x());
+        if (ch.change & SceneData::ModelChange::ScaleY)
+            v.setY(ch.scale.y());
+        if (ch.change & SceneData::ModelChange::ScaleZ)
+            v.setZ(ch.scale.z());
+        t->setScale3D(v);
+    }
+
+    if ((ch.change & SceneData::ModelChange::Color) && mc.material)
+        setMaterialDiffuse(mc.material, ch.color);
+}
+
+void ScenePlayer::gatherRecordedModels(const QHash<QByteArray, SceneData::Model> &models, int parent,
+                                       QByteArrayList *ids, QVector<int> *parents)
+{
+    // Sorted so that recordings of the same scene have the same layout.
+    QByteArrayList sortedIds = models.keys();
+    std::sort(sortedIds.begin(), sortedIds.end());
+    for (const QByteArray &id : qAsConst(sortedIds)) {
+        const int idx = ids->count();
+        ids->append(id);
+        parents->append(parent);
+        gatherRecordedModels(models[id].childModels, idx, ids, parents);
+    }
+}
+
+void ScenePlayer::setupRecording(const SceneData &sd)
+{
+    QByteArrayList ids;
+    QVector<int> parents;
+    gatherRecordedModels(sd.models, -1, &ids, &parents);
+    // Models in prefabs are recorded once, relative to their instance.
+    QByteArrayList prefabIds = sd.prefabs.keys();
+    std::sort(prefabIds.begin(), prefabIds.end());
+    for (const QByteArray &prefabId : qAsConst(prefabIds))
+        gatherRecordedModels(sd.prefabs[prefabId].models, -1, &ids, &parents);
+
+    m_recordIds = ids;
+    m_lastRecordedTick = -1;
+    m_recorder.open(m_recordFile, m_recordInterval, ids, parents);
+}
+
+void ScenePlayer::recordFrame(int pos)
+{
+    const int tick = pos / m_recorder.interval();
+    if (tick == m_lastRecordedTick)
+        return;
+
+    if (tick < m_lastRecordedTick) {
+        // Looped around; one pass is enough.
+        m_recorder.close();
+        return;
+    }
+
+    QVector<RecordedModelState> states(m_recordIds.count());
+    for (int i = 0; i < m_recordIds.count(); ++i) {
+        auto it = m_scene.modelNodes.constFind(m_recordIds[i]);
+        if (it == m_scene.modelNodes.constEnd())
+            continue;
+        const ModelComponents &mc(it->components);
+        states[i].set(mc.transform->translation(), mc.transform->rotation(), mc.transform->scale3D(),
+                      mc.material ? materialDiffuse(mc.material) : QColor(Qt::black));
+    }
+    m_recorder.writeFrame(tick, states);
+    m_lastRecordedTick = tick;
+}
+
+void ScenePlayer::applyReplay(int pos)
+{
+    const int frame = m_replay->findFrame(pos);
+    if (frame < 0 || frame == m_scene.replayFrame)
+        return;
+
+    if (!m_replay->readFrame(frame, &m_replayStates))
+        return;
+    m_scene.replayFrame = frame;
+
+    const QByteArrayList &ids(m_replay->ids());
+    for (int i = 0; i < ids.count(); ++i) {
+        const RecordedModelState &s(m_replayStates[i]);
+        if (!s.present)
+            continue;
+        auto it = m_scene.modelNodes.constFind(ids[i]);
+        if (it == m_scene.modelNodes.constEnd())
+            continue;
+        const ModelComponents &mc(it->components);
+        mc.transform->setTranslation(s.translation());
+        mc.transform->setRotation(s.rotation());
+        mc.transform->setScale3D(s.scale());
+        if (mc.material)
+            setMaterialDiffuse(mc.material, s.color());
+    }
+}
+
+// Window swaps happen this many ms ahead of the boundary, giving the backend time to pick up the new clips.
+static const int StreamOverlap = 1000;
+
+void ScenePlayer::setStreamWindow(int ms)
+{
+    m_streamWindow = ms > 0 ? qMax(ms, 2 * StreamOverlap) : 0;
+}
+
+void ScenePlayer::onIndexReady()
+{
+    m_streamIndex = m_indexWatcher.result();
+    m_window = ClipWindow();
+    m_nextWindow = ClipWindow();
+    if (!m_streamIndex.isValid())
+        return;
+
+    requestWindow(0, false);
+}
+
+void ScenePlayer::requestWindow(int index, bool resume)
+{
+    QHash<QByteArray, ClipBuilder> builders;
+    int frame = -1;
+    if (resume) {
+        builders = m_window.resume;
+        frame = m_window.resumeFrame;
+    }
+
+    m_requestedWindow = index;
+    const SceneIndex sceneIndex = m_streamIndex;
+    const int windowLength = m_streamWindow;
+    m_windowWatcher.setFuture(QtConcurrent::run([=] {
+        return buildClipWindow(sceneIndex, index, windowLength, StreamOverlap, builders, frame);
+    }));
+}
+
+void ScenePlayer::onWindowBuilt()
+{
+    m_requestedWindow = -1;
+    const ClipWindow w = m_windowWatcher.result();
+
+    if (!m_window.isValid()) {
+        // The first window; the animators get created with its clips.
+        m_window = w;
+        setupScene(m_streamIndex.header);
+        return;
+    }
+
+    m_nextWindow = w;
+    updateStreaming(position());
+}
+
+void ScenePlayer::updateStreaming(int pos)
+{
+    if (!m_window.isValid())
+        return;
+
+    if (m_nextWindow.covers(pos))
+        applyWindow();
+
+    if (!m_window.covers(pos)) {
+        // Seeked away or looped around without a prefetched window: read up to
+        // the new position from the beginning. The old clips stay until then.
+        const int index = pos / m_streamWindow;
+        if (!m_windowWatcher.isRunning() && m_requestedWindow != index)
+            requestWindow(index, false);
+        return;
+    }
+
+    // Prefetch the following window.
+    if (!m_nextWindow.isValid() && !m_windowWatcher.isRunning()) {
+        if (m_window.end != INT_MAX)
+            requestWindow(m_window.index + 1, true);
+        else if (m_loop && m_window.index != 0)
+            requestWindow(0, false);
+    }
+}
+
+void ScenePlayer::applyWindow()
+{
+    TRACE_SCOPE_ARG("applyWindow", "window", QByteArray::number(m_nextWindow.index));
+    m_window = m_nextWindow;
+    m_nextWindow = ClipWindow();
+
+    // Only the clip data changes. The clips keep spanning the whole timeline so
+    // the animators' playheads carry on as they are.
+    for (auto it = m_window.clips.cbegin(), ite = m_window.clips.cend(); it != ite; ++it) {
+        auto node = m_scene.modelNodes.constFind(it.key());
+        if (node == m_scene.modelNodes.constEnd() || !node->animator)
+            continue;
+        if (Qt3DAnimation::QAnimationClip *clip = qobject_cast<Qt3DAnimation::QAnimationClip *>(node->animator->clip()))
+            clip->setClipData(it.value());
+    }
+}
+
+// How far ahead of a change continuous rendering is turned back on, in ms of wall time.
+static const int IdleWakeLead = 100;
+
+void ScenePlayer::setRenderSettings(QObject *settings)
+{
+    if (m_renderSettings && m_idle)
+        m_renderSettings->setRenderPolicy(Qt3DRender::QRenderSettings::Always);
+    m_renderSettings = qobject_cast<Qt3DRender::QRenderSettings *>(settings);
+    m_idle = false;
+    if (m_renderSettings)
+        updateRenderPolicy();
+}
+
+int ScenePlayer::idleTime() const
+{
+    return int(m_idleTotal + (m_idle ? m_idleTimer.elapsed() : 0));
+}
+
+void ScenePlayer::setIdle(bool idle)
+{
+    if (m_idle == idle)
+        return;
+
+    m_idle = idle;
+    if (idle)
+        m_idleTimer.start();
+    else
+        m_idleTotal += m_idleTimer.elapsed();
+    m_renderSettings->setRenderPolicy(idle ? Qt3DRender::QRenderSettings::OnDemand
+                                           : Qt3DRender::QRenderSettings::Always);
+    emit idleChanged();
+}
+
+// Seconds skipped at the start of a benchmark, when textures and buffers are still being uploaded.
+static const float BenchmarkWarmup = 1;
+
+void ScenePlayer::updateBenchmark(float dt)
+{
+    if (m_duration <= 0 || !m_scene.pendingModels.isEmpty())
+        return;
+
+    m_benchmarkElapsed += dt;
+    if (m_benchmarkElapsed < BenchmarkWarmup)
+        return;
+
+    m_frameTimes.append(dt * 1000);
+    if (m_scene.lighting) {
+        m_lightsPerTileSum += m_scene.lighting->averageLightsPerTile();
+        m_lightsPerTileMax = qMax(m_lightsPerTileMax, m_scene.lighting->maxLightsPerTile());
+    }
+    if (m_benchmarkElapsed < BenchmarkWarmup + m_benchmark)
+        return;
+
+    QVector<float> sorted = m_frameTimes;
+    std::sort(sorted.begin(), sorted.end());
+    const float avg = std::accumulate(sorted.cbegin(), sorted.cend(), 0.0f) / sorted.count();
+    qDebug("Benchmark: %d frames, frame time avg %.2f ms, p95 %.2f ms, max %.2f ms",
+           sorted.count(), avg, sorted[int(0.95f * (sorted.count() - 1))], sorted.last());
+    if (m_scene.lighting) {
+        qDebug("Benchmark: %d point lights, clustered, lights per tile avg %.1f max %d",
+               m_scene.lighting->pointLightCount(), m_lightsPerTileSum / sorted.count(), m_lightsPerTileMax);
+    } else {
+        qDebug("Benchmark: %d point lights, forward", m_scene.pointLightCount);
+    }
+
+    m_benchmark = 0;
+    m_frameTimes.clear();
+    m_benchmarkElapsed = 0;
+    m_lightsPerTileSum = 0;
+    m_lightsPerTileMax = 0;
+    emit benchmarkFinished();
+}
+
+// Quality levels of the governor, from full quality down.
+static const struct {
+    qreal lodBias;
+    int lightLimit; // 0 for all
+} QualityLevels[] = {
+    { 1, 0 },
+    { 1.5, 128 },
+    { 2, 64 },
+    { 3, 32 },
+    { 4, 16 }
+};
+static const int MaxQualityLevel = sizeof(QualityLevels) / sizeof(QualityLevels[0]) - 1;
+
+// The governor averages over this many seconds, and only acts when several averages
+// in a row agree; it takes more of them to raise the quality so that it does not
+// bounce between two levels.
+static const float QualityInterval = 0.5f;
+static const float QualityOverBudget = 1.1f; // of the target frame time
+static const float QualityUnderBudget = 0.7f;
+static const int QualityLowerAfter = 2;
+static const int QualityRaiseAfter = 6;
+
+void ScenePlayer::setTargetFrameTime(qreal ms)
+{
+    m_targetFrameTime = qMax<qreal>(0, ms);
+    m_qualityElapsed = m_qualityFrameTimeSum = 0;
+    m_qualityFrames = m_qualityStreak = 0;
+    if (m_targetFrameTime <= 0 && m_qualityLevel > 0)
+        setQualityLevel(0, 0);
+}
+
+void ScenePlayer::updateQuality(float dt)
+{
+    // Frames rendered on demand, while paused or while models are still being
+    // built say nothing about the scene's steady state.
+    if (m_idle || !m_playing || !m_scene.pendingModels.isEmpty()) {
+        m_qualityElapsed = m_qualityFrameTimeSum = 0;
+        m_qualityFrames = 0;
+        return;
+    }
+
+    m_qualityElapsed += dt;
+    m_qualityFrameTimeSum += dt * 1000;
+    ++m_qualityFrames;
+    if (m_qualityElapsed < QualityInterval)
+        return;
+
+    const float frameTime = m_qualityFrameTimeSum / m_qualityFrames;
+    m_qualityElapsed = m_qualityFrameTimeSum = 0;
+    m_qualityFrames = 0;
+    if (frameTime > m_targetFrameTime * QualityOverBudget)
+        m_qualityStreak = qMax(m_qualityStreak, 0) + 1;
+    else if (frameTime < m_targetFrameTime * QualityUnderBudget)
+        m_qualityStreak = qMin(m_qualityStreak, 0) - 1;
+    else
+        m_qualityStreak = 0;
+
+    if (m_qualityStreak >= QualityLowerAfter && m_qualityLevel < MaxQualityLevel)
+        setQualityLevel(m_qualityLevel + 1, frameTime);
+    else if (m_qualityStreak <= -QualityRaiseAfter && m_qualityLevel > 0)
+        setQualityLevel(m_qualityLevel - 1, frameTime);
+}
+
+void ScenePlayer::setQualityLevel(int level, float frameTime)
+{
+    qDebug("Quality level %d -> %d at frame time %.2f ms (target %.2f ms): LOD bias x%.2f, light limit %d",
+           m_qualityLevel, level, frameTime, m_targetFrameTime,
+           QualityLevels[level].lodBias, QualityLevels[level].lightLimit);
+    m_qualityLevel = level;
+    m_qualityStreak = 0;
+
+    updateLodThresholds();
+    if (m_scene.lighting)
+        m_scene.lighting->setLightLimit(QualityLevels[level].lightLimit);
+    if (m_nextScene.lighting)
+        m_nextScene.lighting->setLightLimit(QualityLevels[level].lightLimit);
+    emit qualityLevelChanged();
+}
+
+qreal ScenePlayer::effectiveLodBias() const
+{
+    return m_lodBias * QualityLevels[m_qualityLevel].lodBias;
+}
+
+void ScenePlayer::updateRenderPolicy()
+{
+    // While paused nothing moves on its own. On demand rendering still picks up
+    // changes made from the frontend, like live changes and entities being added.
+    if (!m_playing || m_duration <= 0) {
+        m_wakeTimer.stop();
+        setIdle(m_duration > 0);
+        return;
+    }
+
+    // A replay changes the models from the frontend at its own rate.
+    if (m_replay || !m_scene.pendingModels.isEmpty() || !m_nextScene.pendingModels.isEmpty() || m_benchmark > 0) {
+        m_wakeTimer.stop();
+        setIdle(false);
+        return;
+    }
+
+    // Find the next interval in which something moves, wrapping around when looping.
+    const int pos = position();
+    auto it = std::lower_bound(m_busyIntervals.cbegin(), m_busyIntervals.cend(), pos,
+                               [](const SceneActivity::Interval &i, int pos) { return i.second <= pos; });
+    int untilBusy = -1; // ms of timeline
+    if (it != m_busyIntervals.cend())
+        untilBusy = qMax(0, it->first - pos);
+    else if (m_loop && !m_busyIntervals.isEmpty())
+        untilBusy = m_duration - pos + m_busyIntervals.first().first;
+
+    const int wallUntilBusy = untilBusy < 0 ? -1 : int(untilBusy / m_playbackRate);
+    if (wallUntilBusy >= 0 && wallUntilBusy <= IdleWakeLead) {
+        m_wakeTimer.stop();
+        setIdle(false);
+        return;
+    }
+
+    setIdle(true);
+    // Frame actions may not come often while idle, so do not rely on them for waking up.
+    int wake = wallUntilBusy > 0 ? wallUntilBusy - IdleWakeLead : -1;
+    const int due = untilDue(pos);
+    if (due > 0) {
+        const int wallUntilDue = qCeil(due / m_playbackRate);
+        wake = wake < 0 ? wallUntilDue : qMin(wake, wallUntilDue);
+    }
+    if (wake >= 0)
+        m_wakeTimer.start(wake);
+    else
+        m_wakeTimer.stop();
+}
+
+// ms of timeline until something is due that frame actions would otherwise do,
+// even though nothing moves: swapping in the next streamed window, or the end of
+// a timeline that does not loop. -1 if nothing.
+int ScenePlayer::untilDue(int pos) const
+{
+    int due = -1;
+    if (m_streaming && m_window.isValid() && m_window.end != INT_MAX && m_window.end - StreamOverlap > pos)
+        due = m_window.end - StreamOverlap - pos;
+    if (!m_loop && m_duration > pos)
+        due = due < 0 ? m_duration - pos : qMin(due, m_duration - pos);
+    return due;
+}
+
+void ScenePlayer::onWake()
+{
+    if (m_streaming)
+        updateStreaming(position());
+    if (m_playing && m_duration > 0 && !finishTimeline())
+        emit positionChanged();
+    updateRenderPolicy();
+}
+
+QString ScenePlayer::filename() const
+{
+    return m_filename;
+}
+
+void ScenePlayer::setFilename(const QString &fn)
+{
+    m_filename = fn;
+    m_streaming = m_streamWindow > 0;
+    if (m_streaming) {
+        // Only the keyframe index is kept, the clips are built per window from the file.
+        m_indexWatcher.setFuture(QtConcurrent::run(&SceneParser::index, fn));
+        return;
+    }
+    m_parser->load(fn);
+    m_watcher.setFuture(*m_parser->future());
+}
+
+void ScenePlayer::setPlaylist(const QStringList &files)
+{
+    if (m_playlist == files)
+        return;
+
+    m_playlist = files;
+    destroyScene(&m_nextScene);
+    m_nextFilename.clear();
+    m_nextSceneData = SceneData();
+    emit playlistChanged();
+    if (m_playlist.isEmpty()) {
+        m_playlistIndex = -1;
+        return;
+    }
+
+    // Each scene plays once, then the next one takes over.
+    setLoop(false);
+    m_playlistIndex = 0;
+    if (m_filename != m_playlist.first())
+        setFilename(m_playlist.first());
+    else if (m_scene.root)
+        prefetchNextScene();
+}
+
+// Whether the next scene can be built up front: everything the staged build
+// creates must be complete and independent of the current scene's state.
+bool ScenePlayer::canPrepareScenes() const
+{
+    return !m_lazyInstantiation && m_buildBudget <= 0 && m_streamWindow <= 0
+            && !m_mergeStatic && m_replayFile.isEmpty() && m_recordFile.isEmpty();
+}
+
+void ScenePlayer::prefetchNextScene()
+{
+    const QString fn = m_playlist.at((m_playlistIndex + 1) % m_playlist.count());
+    if (fn == m_nextFilename)
+        return;
+
+    destroyScene(&m_nextScene);
+    m_nextSceneData = SceneData();
+    m_nextFilename = fn;
+    m_prefetchWatcher.setFuture(SceneCache::instance()->load(fn));
+}
+
+void ScenePlayer::onPrefetchParsed()
+{
+    const SceneData sd = m_prefetchWatcher.result();
+    if (m_nextFilename.isEmpty() || sd.frames.isEmpty() || !canPrepareScenes())
+        return; // parsed and cached at least; advancePlaylist() loads it the usual way
+
+    m_nextSceneData = sd;
+    m_clipsWatcher.setFuture(QtConcurrent::run(&ClipBuilder::buildAll, sd));
+}
+
+void ScenePlayer::onPrefetchClipsBuilt()
+{
+    if (m_nextScene.root || m_nextSceneData.frames.isEmpty())
+        return;
+
+    // Nothing is rendered from the new root until it gets enabled. The models
+    // are queued and built a few at a time from onFrame(), see buildNextScene().
+    if (createSceneRoot(&m_nextScene, m_nextSceneData, false)) {
+        m_nextScene.clips = m_clipsWatcher.result();
+        enqueueModels(&m_nextScene, m_nextSceneData.models, m_nextScene.root, QByteArray());
+    }
+    if (m_renderSettings)
+        updateRenderPolicy();
+}
+
+// How long preparing the next scene may take per frame, in ms.
+static const int PrepareBudget = 4;
+
+// budget is in ns.
+void ScenePlayer::buildNextScene(qint64 budget)
+{
+    TRACE_SCOPE_ARG("ScenePlayer::prepareScene", "file", m_nextFilename.toUtf8());
+    buildPendingModels(&m_nextScene, m_nextSceneData, budget);
+    if (m_nextScene.pendingModels.isEmpty())
+        m_nextScene.clips.clear(); // held by the clips now
+}
+
+void ScenePlayer::advancePlaylist()
+{
+    m_playlistIndex = (m_playlistIndex + 1) % m_playlist.count();
+    const QString fn = m_playlist.at(m_playlistIndex);
+    if (!m_nextScene.root || m_nextFilename != fn) {
+        // Not prepared (yet); load it the usual way, the parse is hopefully cached.
+        destroyScene(&m_scene);
+        m_nextFilename.clear();
+        m_nextSceneData = SceneData();
+        setFilename(fn);
+        return;
+    }
+
+    TRACE_SCOPE("ScenePlayer::advancePlaylist");
+    // Whatever is left of the preparation is built now.
+    buildNextScene(std::numeric_limits<qint64>::max());
+    destroyScene(&m_scene);
+    m_lazyModels.clear();
+    std::swap(m_scene, m_nextScene);
+    m_nextFilename.clear();
+    m_lodDrawCountsDirty = true;
+
+    m_scene.root->setEnabled(true);
+    applyCameras();
+    m_filename = fn;
+    emit filenameChanged();
+
+    startTimeline(m_nextSceneData);
+    m_totalModels = m_builtModels = countModels(m_nextSceneData, m_nextSceneData.models);
+    emit buildProgressChanged(m_builtModels, m_totalModels);
+    for (Qt3DAnimation::QClipAnimator *animator : qAsConst(m_scene.animators)) {
+        if (!m_scene.suspendedAnimators.contains(animator))
+            animator->setRunning(m_playing);
+    }
+    m_nextSceneData = SceneData();
+
+    prefetchNextScene();
+}
+
+// The cameras of a scene divide the surface between them, see MultiViewRenderer.
+static qreal viewAspectRatio(qreal surfaceAspectRatio, int view, int count)
+{
+    const QRectF r = MultiViewRenderer::viewRect(view, count);
+    return surfaceAspectRatio * r.width() / r.height();
+}
+
+// In pixels, with the origin at the bottom left like gl_FragCoord.
+static QRect viewportPixels(const QRectF &r, const QSize &surfaceSize)
+{
+    const int x0 = qRound(r.left() * surfaceSize.width());
+    const int x1 = qRound(r.right() * surfaceSize.width());
+    const int y0 = qRound((1 - r.bottom()) * surfaceSize.height());
+    const int y1 = qRound((1 - r.top()) * surfaceSize.height());
+    return QRect(x0, y0, x1 - x0, y1 - y0);
+}
+
+void ScenePlayer::setAspectRatio(qreal ratio)
+{
+    if (m_aspectRatio != ratio) {
+        m_aspectRatio = ratio;
+        for (const Scene *scene : { &m_scene, &m_nextScene }) {
+            for (int i = 0; i < scene->cameras.count(); ++i)
+                scene->cameras[i]->setAspectRatio(viewAspectRatio(m_aspectRatio, i, scene->cameras.count()));
+        }
+    }
+}
+
+void ScenePlayer::setPlaying(bool playing)
+{
+    if (m_playing == playing)
+        return;
+
+    // A timeline that played to its end starts over.
+    if (playing && !m_loop && m_duration > 0 && position() >= m_duration)
+        seek(0);
+    resetPlayhead(position());
+    m_playing = playing;
+    for (Qt3DAnimation::QClipAnimator *animator : qAsConst(m_scene.animators)) {
+        if (m_scene.suspendedAnimators.contains(animator))
+            continue;
+        if (playing && m_duration > 0)
+            animator->setNormalizedTime(m_playheadAnchor / float(m_duration));
+        animator->setRunning(playing);
+    }
+    if (m_renderSettings)
+        updateRenderPolicy();
+    emit playingChanged();
+}
+
+int ScenePlayer::position() const
+{
+    if (!m_playing || !m_playheadTimer.isValid() || m_duration <= 0)
+        return m_playheadAnchor;
+
+    const qint64 pos = m_playheadAnchor + qint64(m_playheadTimer.elapsed() * m_playbackRate);
+    return m_loop ? int(pos % m_duration) : int(qMin<qint64>(pos, m_duration));
+}
+
+void ScenePlayer::seek(int pos)
+{
+    pos = qBound(0, pos, m_duration);
+    resetPlayhead(pos);
+
+    // Only the playhead of each animator moves; the clips stay as they are and the
+    // backend locates the keyframe pair for the new time with a binary search.
+    if (m_duration > 0) {
+        const float normalizedTime = pos / float(m_duration);
+        for (Qt3DAnimation::QClipAnimator *animator : qAsConst(m_scene.animators))
+            animator->setNormalizedTime(normalizedTime);
+    }
+    if (!m_lazyModels.isEmpty())
+        updateLazyModels(pos);
+    if (!m_scene.visibility.isEmpty())
+        updateVisibility(pos);
+    if (m_replay)
+        applyReplay(pos);
+    if (m_streaming)
+        updateStreaming(pos);
+    if (m_renderSettings)
+        updateRenderPolicy();
+    emit positionChanged();
+}
+
+void ScenePlayer::setPlaybackRate(qreal rate)
+{
+    if (rate <= 0) {
+        qWarning("Invalid playback rate %f", rate);
+        return;
+    }
+    if (m_playbackRate == rate)
+        return;
+
+    resetPlayhead(position());
+    m_playbackRate = rate;
+    m_clock->setPlaybackRate(rate);
+    if (m_renderSettings)
+        updateRenderPolicy();
+    emit playbackRateChanged();
+}
+
+void ScenePlayer::setLoop(bool loop)
+{
+    if (m_loop == loop)
+        return;
+
+    resetPlayhead(position());
+    m_loop = loop;
+    for (Qt3DAnimation::QClipAnimator *animator : qAsConst(m_scene.animators))
+        animator->setLoopCount(loop ? Qt3DAnimation::QAbstractClipAnimator::Infinite : 1);
+    if (m_renderSettings)
+        updateRenderPolicy();
+    emit loopChanged();
+}
+
+void ScenePlayer::resetPlayhead(int pos)
+{
+    m_playheadAnchor = pos;
+    m_playheadTimer.start();
+}
+
+void ScenePlayer::startAnimator(Scene *scene, Qt3DAnimation::QClipAnimator *animator)
+{
+    animator->setClock(m_clock);
+    animator->setLoopCount(m_loop ? Qt3DAnimation::QAbstractClipAnimator::Infinite : 1);
+    scene->animators.append(animator);
+    const bool hidden = !isShown(scene, qobject_cast<Qt3DCore::QEntity *>(animator->parent()));
+    if (hidden)
+        scene->suspendedAnimators.insert(animator);
+    if (scene != &m_scene) {
+        // Started when the scene is swapped in, see advancePlaylist().
+        animator->setNormalizedTime(0);
+        animator->setRunning(false);
+        return;
+    }
+    if (m_duration > 0)
+        animator->setNormalizedTime(position() / float(m_duration));
+    animator->setRunning(m_playing && !hidden);
+}
+
+void ScenePlayer::onFrame(float dt)
+{
+    // Live changes are applied in one batch per frame.
+    if (m_liveControl)
+        applyLiveChanges();
+
+    if (!m_scene.pendingModels.isEmpty())
+        buildPendingModels(&m_scene, m_sceneData, m_buildBudget * qint64(1000000));
+
+    if (!m_nextScene.pendingModels.isEmpty())
+        buildNextScene(PrepareBudget * qint64(1000000));
+
+    if (!m_lazyModels.isEmpty())
+        updateLazyModels(position());
+
+    if (!m_scene.visibility.isEmpty())
+        updateVisibility(position());
+
+    if (m_replay)
+        applyReplay(position());
+
+    if (m_streaming)
+        updateStreaming(position());
+
+    if (m_scene.lighting) {
+        const int views = m_scene.cameras.count();
+        for (int i = 0; i < views; ++i) {
+            const Qt3DRender::QCamera *cam = m_scene.cameras[i];
+            m_scene.lighting->update(i, cam->viewMatrix(), cam->projectionMatrix(),
+                                     viewportPixels(MultiViewRenderer::viewRect(i, views), m_surfaceSize));
+        }
+    }
+
+    if (m_lodDrawCountsDirty) {
+        m_lodDrawCountsDirty = false;
+        emit lodDrawCountsChanged();
+    }
+
+    if (m_benchmark > 0)
+        updateBenchmark(dt);
+
+    if (m_targetFrameTime > 0)
+        updateQuality(dt);
+
+    if (m_renderSettings)
+        updateRenderPolicy();
+
+    if (!m_playing || m_duration <= 0)
+        return;
+
+    if (m_recorder.isOpen())
+        recordFrame(position());
+
+    if (!finishTimeline())
+        emit positionChanged();
+}
+
+// Moves on to the next scene of the playlist, or stops, once a timeline that
+// does not loop has reached its end. Returns true when the scene was replaced.
+bool ScenePlayer::finishTimeline()
+{
+    if (m_loop || position() < m_duration)
+        return false;
+
+    if (!m_playlist.isEmpty() && m_scene.root) {
+        advancePlaylist();
+        return true;
+    }
+
+    resetPlayhead(m_duration);
+    m_playing = false;
+    if (m_recorder.isOpen())
+        m_recorder.close();
+    if (m_renderSettings)
+        updateRenderPolicy();
+    emit playingChanged();
+    return false;
+}
+
+// Creates m_scene.root with the camera and the lights of sd, but no models yet.
+bool ScenePlayer::createSceneRoot(Scene *scene, const SceneData &sd, bool enabled)
+{
+    if (sd.frames.isEmpty()) {
+        qWarning("No keyframes");
+        return false;
+    }
+
+    const SceneData::Frame &firstFrame(sd.frames.first());
+    if (firstFrame.t != 0) {
+        qWarning("Keyframe @0 is mandatory"); // for now
+        return false;
+    }
+
+    scene->root = new Qt3DCore::QEntity(this);
+    scene->root->setEnabled(enabled);
+
+    // Initial camera settings
+    QByteArrayList cameraIds = sd.cameras.toList();
+    std::sort(cameraIds.begin(), cameraIds.end());
+    if (cameraIds.count() > 1 && !m_renderSettings) {
+        qWarning("Multiple cameras need renderSettings for the viewports; only one will be used");
+        cameraIds = cameraIds.mid(0, 1);
+    }
+    for (const QByteArray &camId : qAsConst(cameraIds)) {
+        SceneData::CameraChange ch = firstFrame.cameraChanges[camId];
+
+        Qt3DRender::QCamera *cam = new Qt3DRender::QCamera(scene->root);
+        cam->setProjectionType(Qt3DRender::QCameraLens::PerspectiveProjection);
+        cam->setFieldOfView(45);
+        cam->setAspectRatio(viewAspectRatio(m_aspectRatio, scene->cameras.count(), cameraIds.count()));
+        cam->setNearPlane(0.01f);
+        cam->setFarPlane(1000.0f);
+        cam->setUpVector(QVector3D(0.0f, 1.0f, 0.0f));
+        if (ch.change & SceneData::CameraChange::Position)
+            cam->setPosition(ch.position);
+        else
+            cam->setPosition(QVector3D(0, 0, 10));
+        if (ch.change & SceneData::CameraChange::ViewCenter)
+            cam->setViewCenter(ch.viewCenter);
+        else
+            cam->setViewCenter(QVector3D(0, 0, 0));
+
+        scene->cameras.append(cam);
+    }
+    if (scene->cameras.isEmpty())
+        qWarning("No camera");
+    else
+        scene->camera = scene->cameras.first();
+
+    // Initial light settings
+    scene->lighting = m_clusteredLighting ? new ClusteredLighting(qMax(1, scene->cameras.count()), scene->root) : nullptr;
+    if (scene->lighting)
+        scene->lighting->setLightLimit(QualityLevels[m_qualityLevel].lightLimit);
+    scene->pointLightCount = sd.pointLights.count();
+    for (const QByteArray &lightId : sd.lights) {
+        QVector3D position;
+        if (firstFrame.lightChanges.contains(lightId)) {
+            const SceneData::LightChange &ch(firstFrame.lightChanges[lightId]);
+            if (ch.change & SceneData::LightChange::Position)
+                position = ch.position;
+        }
+        auto pointLight = sd.pointLights.constFind(lightId);
+
+        if (scene->lighting) {
+            if (pointLight != sd.pointLights.constEnd())
+                scene->lighting->addPointLight(position, pointLight->range, pointLight->color);
+            else
+                scene->lighting->addDirectionalLight(QVector3D(0, 0, -1));
+            continue;
+        }
+
+        Qt3DCore::QEntity *lightEntity = new Qt3DCore::QEntity(scene->root);
+        if (pointLight != sd.pointLights.constEnd()) {
+            Qt3DRender::QPointLight *light = new Qt3DRender::QPointLight;
+            light->setColor(pointLight->color);
+            // No cutoff here, unlike the clustered path; falls to 1/26 at the
+            // range, see format_ref.txt.
+            light->setConstantAttenuation(1);
+            light->setLinearAttenuation(0);
+            light->setQuadraticAttenuation(25 / (pointLight->range * pointLight->range));
+            lightEntity->addComponent(light);
+        } else {
+            Qt3DRender::QDirectionalLight *light = new Qt3DRender::QDirectionalLight;
+            light->setWorldDirection(QVector3D(0, 0, -1));
+            lightEntity->addComponent(light);
+        }
+        Qt3DCore::QTransform *t = new Qt3DCore::QTransform;
+        t->setTranslation(position);
+        lightEntity->addComponent(t);
+    }
+    if (sd.pointLights.count() > 8 && !scene->lighting)
+        qWarning("%d point lights; the default materials only use 8 lights, see clusteredLighting", sd.pointLights.count());
+
+    // Stepped through from onFrame() for the entities created later on.
+    if (m_streaming) {
+        for (auto it = m_streamIndex.modelKeys.cbegin(), ite = m_streamIndex.modelKeys.cend(); it != ite; ++it) {
+            if (!it->visibility.isEmpty())
+                scene->visibilityKeys.insert(it.key(), it->visibility);
+        }
+    } else {
+        for (const SceneData::Frame &f : sd.frames) {
+            for (auto it = f.modelChanges.cbegin(), ite = f.modelChanges.cend(); it != ite; ++it) {
+                if (it->change & SceneData::ModelChange::Visible)
+                    scene->visibilityKeys[it.key()].append(qMakePair(f.t, it->visible));
+            }
+        }
+    }
+
+    return true;
+}
+
+void ScenePlayer::startTimeline(const SceneData &sd)
+{
+    m_duration = sd.totalTime;
+    resetPlayhead(0);
+    emit durationChanged();
+    addPlayheadAnimator();
+
+    if (m_streaming) {
+        m_busyIntervals = m_streamIndex.activity.intervals();
+    } else {
+        SceneActivity activity;
+        activity.addFrames(sd.frames);
+        m_busyIntervals = activity.intervals();
+    }
+}
+
+// position() follows an animator that targets nothing visible: it runs on m_clock
+// like all the others, so the playhead keeps up with the backend's time through
+// rate changes and stalls instead of counting wall time on its own.
+void ScenePlayer::addPlayheadAnimator()
+{
+    if (m_duration <= 0)
+        return;
+
+    Qt3DCore::QEntity *entity = new Qt3DCore::QEntity(m_scene.root);
+    Qt3DCore::QTransform *target = new Qt3DCore::QTransform(entity); // not a component
+
+    Qt3DAnimation::QChannelComponent comp(QStringLiteral("Scale"));
+    comp.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(0.0f, 1.0f)));
+    comp.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(m_duration / 1000.0f, 1.0f)));
+    Qt3DAnimation::QChannel channel(QStringLiteral("Scale"));
+    channel.appendChannelComponent(comp);
+    Qt3DAnimation::QAnimationClipData clipData;
+    clipData.appendChannel(channel);
+    Qt3DAnimation::QAnimationClip *clip = new Qt3DAnimation::QAnimationClip;
+    clip->setClipData(clipData);
+
+    Qt3DAnimation::QChannelMapping *mapping = new Qt3DAnimation::QChannelMapping;
+    mapping->setChannelName(QStringLiteral("Scale"));
+    mapping->setTarget(target);
+    mapping->setProperty(QStringLiteral("scale"));
+    Qt3DAnimation::QChannelMapper *mapper = new Qt3DAnimation::QChannelMapper;
+    mapper->addMapping(mapping);
+
+    Qt3DAnimation::QClipAnimator *animator = new Qt3DAnimation::QClipAnimator;
+    animator->setChannelMapper(mapper);
+    animator->setClip(clip);
+    entity->addComponent(animator);
+    connect(animator, &Qt3DAnimation::QAbstractClipAnimator::normalizedTimeChanged,
+            this, &ScenePlayer::onPlayheadTime);
+    startAnimator(&m_scene, animator);
+}
+
+void ScenePlayer::onPlayheadTime(float normalizedTime)
+{
+    if (!m_playing || m_duration <= 0)
+        return;
+    // The wall timer only extrapolates until the next update, e.g. while
+    // rendering on demand lets the aspects idle.
+    resetPlayhead(qRound(normalizedTime * m_duration));
+}
+
+void ScenePlayer::destroyScene(Scene *scene)
+{
+    delete scene->root; // and with it everything else
+    *scene = Scene();
+}
+
+// The forward renderer always gets the first camera, which is what the camera
+// controller in main.qml moves. With several cameras the multi-view frame graph
+// takes over drawing, one viewport per camera, over the same scene graph.
+void ScenePlayer::applyCameras()
+{
+    Qt3DExtras::QForwardRenderer *r = qobject_cast<Qt3DExtras::QForwardRenderer *>(m_renderer);
+    if (r && m_scene.camera)
+        r->setCamera(m_scene.camera);
+    if (!m_renderSettings)
+        return;
+
+    if (m_scene.cameras.count() > 1) {
+        if (!m_multiView) {
+            m_multiView = new MultiViewRenderer;
+            if (r)
+                m_multiView->setClearColor(r->clearColor());
+        }
+        // Render to wherever the forward renderer does; in a Scene3D its
+        // surface is only known to it.
+        if (r) {
+            m_multiView->setSurface(r->surface());
+            m_multiView->setExternalRenderTargetSize(r->externalRenderTargetSize());
+        }
+        m_multiView->setViews(m_scene.cameras, m_scene.lighting);
+        m_renderSettings->setActiveFrameGraph(m_multiView);
+    } else if (m_multiView) {
+        m_renderSettings->setActiveFrameGraph(qobject_cast<Qt3DRender::QFrameGraphNode *>(m_renderer));
+        delete m_multiView;
+        m_multiView = nullptr;
+    }
 }
 
-ScenePlayer::~ScenePlayer()
+void ScenePlayer::setupScene(const SceneData &sd)
 {
+    TRACE_SCOPE("ScenePlayer::setupScene");
+    // must have been set by the time the async file parsing finishes
+    Q_ASSERT(qobject_cast<Qt3DExtras::QForwardRenderer *>(m_renderer));
+
+    // Replaces whatever was loaded before.
+    destroyScene(&m_scene);
+    m_lazyModels.clear();
+    m_lodDrawCountsDirty = true;
+    if (!createSceneRoot(&m_scene, sd, true))
+        return;
+    applyCameras();
+    startTimeline(sd);
+    if (!m_playlist.isEmpty())
+        prefetchNextScene();
+
+    // Add models and their animations.
+    QHash<QByteArray, SceneData::Model> models = sd.models;
+    if (m_mergeStatic)
+        mergeStaticModels(sd, &models);
+
+    m_builtModels = 0;
+    m_totalModels = countModels(sd, models);
+
+    m_replay.reset();
+    if (!m_replayFile.isEmpty()) {
+        m_replay.reset(new SceneRecording);
+        if (!m_replay->load(m_replayFile))
+            m_replay.reset();
+        m_scene.replayFrame = -1;
+    }
+    if (!m_recordFile.isEmpty())
+        setupRecording(sd);
+
+    if (m_lazyInstantiation) {
+        // Keep our own (implicitly shared) copy since the models are instantiated later on.
+        m_sceneData = sd;
+        m_sceneData.models = models;
+        setupLazyModels(m_sceneData);
+        updateLazyModels(0);
+        return;
+    }
+
+    if (m_buildBudget > 0) {
+        // Build breadth-first in per-frame batches from onFrame(), top-level models first.
+        m_sceneData = sd;
+        m_sceneData.models = models;
+        enqueueModels(&m_scene, m_sceneData.models, m_scene.root, QByteArray());
+        buildPendingModels(&m_scene, m_sceneData, m_buildBudget * qint64(1000000));
+        return;
+    }
+
+    TRACE_SCOPE("recursiveAddModels");
+    recursiveAddModels(&m_scene, sd, models, m_scene.root, QByteArray());
+    m_builtModels = m_totalModels;
+    emit buildProgressChanged(m_builtModels, m_totalModels);
 }
 
-QString ScenePlayer::filename() const
+static bool isStaticSubtree(const QSet<QByteArray> &animated, const QByteArray &id, const SceneData::Model &mdl)
 {
-    return m_filename;
+    // Levels of detail need their own entities to switch between.
+    if (animated.contains(id) || !mdl.prefab.isEmpty() || !mdl.lodFilenames.isEmpty())
+        return false;
+    for (auto it = mdl.childModels.cbegin(), ite = mdl.childModels.cend(); it != ite; ++it) {
+        if (!isStaticSubtree(animated, it.key(), it.value()))
+            return false;
+    }
+    return true;
 }
 
-void ScenePlayer::setFilename(const QString &fn)
+static void collectStaticMeshes(const SceneData::Frame &firstFrame,
+                                const QByteArray &id,
+                                const SceneData::Model &mdl,
+                                const QMatrix4x4 &parentWorld,
+                                QVector<StaticMeshInstance> *instances)
 {
-    m_filename = fn;
-    m_parser->load(fn);
-    QObject::connect(&m_watcher, &QFutureWatcherBase::finished, [this] {
-        setupScene(m_watcher.result());
-    });
-    m_watcher.setFuture(*m_parser->future());
+    // Same composition as QTransform: translation * rotation * scale.
+    QMatrix4x4 local;
+    QColor color = QColor::fromRgbF(0.7, 0.7, 0.7); // QPhongMaterial's default diffuse
+    auto it = firstFrame.modelChanges.constFind(id);
+    if (it != firstFrame.modelChanges.constEnd()) {
+        const SceneData::ModelChange &ch(*it);
+        if (ch.change & SceneData::ModelChange::Translation)
+            local.translate(ch.translation);
+        if (ch.change & SceneData::ModelChange::Rotation)
+            local.rotate(QQuaternion::fromEulerAngles(ch.rotation));
+        if (ch.change & SceneData::ModelChange::Scale)
+            local.scale(ch.scale);
+        if (ch.change & SceneData::ModelChange::Color)
+            color = ch.color;
+        if ((ch.change & SceneData::ModelChange::Visible) && !ch.visible)
+            return; // and never shown, since it is static
+    }
+    const QMatrix4x4 world = parentWorld * local;
+
+    if (!mdl.filename.isEmpty())
+        instances->append({ mdl.filename, world, color });
+    for (auto cit = mdl.childModels.cbegin(), cite = mdl.childModels.cend(); cit != cite; ++cit)
+        collectStaticMeshes(firstFrame, cit.key(), cit.value(), world, instances);
 }
 
-void ScenePlayer::setAspectRatio(qreal ratio)
+void ScenePlayer::mergeStaticModels(const SceneData &sd, QHash<QByteArray, SceneData::Model> *models)
 {
-    if (m_aspectRatio != ratio) {
-        m_aspectRatio = ratio;
-        Qt3DExtras::QForwardRenderer *r = qobject_cast<Qt3DExtras::QForwardRenderer *>(m_renderer);
-        if (r) {
-            Qt3DRender::QCamera *cam = qobject_cast<Qt3DRender::QCamera *>(r->camera());
-            if (cam)
-                cam->setAspectRatio(m_aspectRatio);
+    TRACE_SCOPE("mergeStaticModels");
+    // Anything with a keyframe after the first one is animated.
+    QSet<QByteArray> animated;
+    for (int i = 1; i < sd.frames.count(); ++i) {
+        const SceneData::Frame &f(sd.frames[i]);
+        for (auto it = f.modelChanges.cbegin(), ite = f.modelChanges.cend(); it != ite; ++it)
+            animated.insert(it.key());
+    }
+    if (m_streaming) {
+        for (auto it = m_streamIndex.modelKeys.cbegin(), ite = m_streamIndex.modelKeys.cend(); it != ite; ++it) {
+            if (it->changes)
+                animated.insert(it.key());
+        }
+    }
+
+    // Only whole subtrees from the top level down can be baked into world space.
+    QVector<StaticMeshInstance> instances;
+    QHash<QByteArray, SceneData::Model> staticModels;
+    for (auto it = models->begin(); it != models->end(); ) {
+        if (isStaticSubtree(animated, it.key(), it.value())) {
+            collectStaticMeshes(sd.frames.first(), it.key(), it.value(), QMatrix4x4(), &instances);
+            staticModels.insert(it.key(), it.value());
+            it = models->erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (instances.isEmpty())
+        return;
+
+    // The originals are shown until addMergedGeometry() replaces them, but only as
+    // placeholders: nothing animates, records or controls them. When the scene is
+    // built over several frames anyway, they are left out instead of all being
+    // created up front.
+    if (!m_lazyInstantiation && m_buildBudget <= 0) {
+        m_staticOriginals = new Qt3DCore::QEntity(m_scene.root);
+        recursiveAddModels(&m_scene, sd, staticModels, m_staticOriginals, QByteArray());
+        QVector<const QHash<QByteArray, SceneData::Model> *> pending { &staticModels };
+        while (!pending.isEmpty()) {
+            const QHash<QByteArray, SceneData::Model> *h = pending.takeLast();
+            for (auto it = h->cbegin(), ite = h->cend(); it != ite; ++it) {
+                m_scene.modelNodes.remove(it.key());
+                pending.append(&it->childModels);
+            }
         }
     }
+
+    m_mergeRoot = m_scene.root;
+    m_mergeWatcher.setFuture(QtConcurrent::run(mergeStaticMeshes, instances));
 }
 
-void ScenePlayer::setupScene(const SceneData &sd)
+void ScenePlayer::addMergedGeometry()
 {
-    Qt3DExtras::QForwardRenderer *r = qobject_cast<Qt3DExtras::QForwardRenderer *>(m_renderer);
-    Q_ASSERT(r); // must have been set by the time the async file parsing finishes
+    // Meant for a scene that has been replaced meanwhile.
+    if (!m_mergeRoot || m_mergeRoot != m_scene.root)
+        return;
 
-    if (sd.frames.isEmpty()) {
-        qWarning("No keyframes");
+    TRACE_SCOPE("addMergedGeometry");
+    const QVector<MergedGeometry> merged = m_mergeWatcher.result();
+    for (const MergedGeometry &g : merged) {
+        Qt3DCore::QEntity *entity = new Qt3DCore::QEntity(m_scene.root);
+        Qt3DRender::QGeometryRenderer *renderer = new Qt3DRender::QGeometryRenderer;
+        Qt3DRender::QGeometry *geometry = new Qt3DRender::QGeometry(renderer);
+
+        Qt3DRender::QBuffer *vertexBuffer = new Qt3DRender::QBuffer(geometry);
+        vertexBuffer->setData(g.vertexData);
+        Qt3DRender::QBuffer *indexBuffer = new Qt3DRender::QBuffer(geometry);
+        indexBuffer->setData(g.indexData);
+
+        const uint stride = 6 * sizeof(float);
+        Qt3DRender::QAttribute *position = new Qt3DRender::QAttribute(vertexBuffer,
+                                                                      Qt3DRender::QAttribute::defaultPositionAttributeName(),
+                                                                      Qt3DRender::QAttribute::Float, 3,
+                                                                      uint(g.vertexCount), 0, stride);
+        Qt3DRender::QAttribute *normal = new Qt3DRender::QAttribute(vertexBuffer,
+                                                                    Qt3DRender::QAttribute::defaultNormalAttributeName(),
+                                                                    Qt3DRender::QAttribute::Float, 3,
+                                                                    uint(g.vertexCount), 3 * sizeof(float), stride);
+        Qt3DRender::QAttribute *index = new Qt3DRender::QAttribute(indexBuffer, Qt3DRender::QAttribute::UnsignedInt,
+                                                                   1, uint(g.indexCount));
+        index->setAttributeType(Qt3DRender::QAttribute::IndexAttribute);
+        geometry->addAttribute(position);
+        geometry->addAttribute(normal);
+        geometry->addAttribute(index);
+        geometry->setBoundingVolumePositionAttribute(position);
+
+        renderer->setPrimitiveType(Qt3DRender::QGeometryRenderer::Triangles);
+        renderer->setGeometry(geometry);
+
+        Qt3DRender::QMaterial *material = createMaterial(&m_scene, nullptr);
+        setMaterialDiffuse(material, g.color);
+
+        entity->addComponent(renderer);
+        entity->addComponent(material);
+    }
+    delete m_staticOriginals;
+}
+
+int ScenePlayer::countModels(const SceneData &sd, const QHash<QByteArray, SceneData::Model> &models)
+{
+    int count = models.count();
+    for (const SceneData::Model &mdl : models) {
+        if (!mdl.prefab.isEmpty())
+            count += mdl.instanceCount() * countModels(sd, sd.prefabs[mdl.prefab].models);
+        count += countModels(sd, mdl.childModels);
+    }
+    return count;
+}
+
+qreal ScenePlayer::buildProgress() const
+{
+    return m_totalModels > 0 ? m_builtModels / qreal(m_totalModels) : 1.0;
+}
+
+void ScenePlayer::enqueueModels(Scene *scene,
+                                const QHash<QByteArray, SceneData::Model> &models,
+                                Qt3DCore::QEntity *parentEntity,
+                                const QByteArray &prefab)
+{
+    for (auto it = models.cbegin(), ite = models.cend(); it != ite; ++it)
+        scene->pendingModels.append({ it.key(), &it.value(), parentEntity, prefab });
+}
+
+// budget is in ns. sd is what the queued models point into.
+void ScenePlayer::buildPendingModels(Scene *scene, const SceneData &sd, qint64 budget)
+{
+    if (scene->pendingHead >= scene->pendingModels.count())
+        return;
+
+    TRACE_SCOPE("buildPendingModels");
+    QElapsedTimer timer;
+    timer.start();
+
+    // At least one model per frame, however small the budget is.
+    int built = 0;
+    do {
+        const PendingModel pm = scene->pendingModels[scene->pendingHead++];
+        Qt3DCore::QEntity *modelEntity = addModel(scene, sd, pm.id, *pm.model, pm.parentEntity, nullptr, pm.prefab);
+        if (!pm.model->prefab.isEmpty()) {
+            const SceneData::Prefab &prefab(sd.prefabs[pm.model->prefab]);
+            for (Qt3DCore::QEntity *cell : addInstanceCells(*pm.model, modelEntity))
+                enqueueModels(scene, prefab.models, cell, pm.model->prefab);
+        }
+        enqueueModels(scene, pm.model->childModels, modelEntity, pm.prefab);
+        ++built;
+    } while (scene->pendingHead < scene->pendingModels.count() && timer.nsecsElapsed() < budget);
+
+    if (scene->pendingHead >= scene->pendingModels.count()) {
+        scene->pendingModels.clear();
+        scene->pendingHead = 0;
+    }
+
+    // The progress is the current scene's, not that of one being prepared.
+    if (scene == &m_scene) {
+        m_builtModels += built;
+        emit buildProgressChanged(m_builtModels, m_totalModels);
+    }
+}
+
+void ScenePlayer::recursiveAddModels(Scene *scene,
+                                     const SceneData &sd,
+                                     const QHash<QByteArray, SceneData::Model> &models,
+                                     Qt3DCore::QEntity *parentEntity,
+                                     const QByteArray &prefab)
+{
+    for (auto it = models.cbegin(), ite = models.cend(); it != ite; ++it) {
+        const SceneData::Model &mdl(it.value());
+        Qt3DCore::QEntity *modelEntity = addModel(scene, sd, it.key(), mdl, parentEntity, nullptr, prefab);
+        if (!mdl.prefab.isEmpty()) {
+            const SceneData::Prefab &instanced(sd.prefabs[mdl.prefab]);
+            for (Qt3DCore::QEntity *cell : addInstanceCells(mdl, modelEntity))
+                recursiveAddModels(scene, sd, instanced.models, cell, mdl.prefab);
+        }
+        recursiveAddModels(scene, sd, mdl.childModels, modelEntity, prefab);
+    }
+}
+
+static void setOptimizedGeometry(Qt3DRender::QGeometryRenderer *renderer, const OptimizedMesh &mesh)
+{
+    if (!mesh.vertexCount)
         return;
+
+    Qt3DRender::QGeometry *geometry = new Qt3DRender::QGeometry(renderer);
+    Qt3DRender::QBuffer *vertexBuffer = new Qt3DRender::QBuffer(geometry);
+    vertexBuffer->setData(mesh.vertexData);
+    Qt3DRender::QBuffer *indexBuffer = new Qt3DRender::QBuffer(geometry);
+    indexBuffer->setData(mesh.indexData);
+
+    const uint stride = uint(mesh.vertexStride());
+    Qt3DRender::QAttribute *position = new Qt3DRender::QAttribute(vertexBuffer,
+                                                                  Qt3DRender::QAttribute::defaultPositionAttributeName(),
+                                                                  Qt3DRender::QAttribute::Float, 3,
+                                                                  uint(mesh.vertexCount), 0, stride);
+    Qt3DRender::QAttribute *normal = new Qt3DRender::QAttribute(vertexBuffer,
+                                                                Qt3DRender::QAttribute::defaultNormalAttributeName(),
+                                                                mesh.halfNormals ? Qt3DRender::QAttribute::HalfFloat
+                                                                                 : Qt3DRender::QAttribute::Float, 3,
+                                                                uint(mesh.vertexCount), 3 * sizeof(float), stride);
+    Qt3DRender::QAttribute *index = new Qt3DRender::QAttribute(indexBuffer,
+                                                               mesh.shortIndices ? Qt3DRender::QAttribute::UnsignedShort
+                                                                                 : Qt3DRender::QAttribute::UnsignedInt,
+                                                               1, uint(mesh.indexCount));
+    index->setAttributeType(Qt3DRender::QAttribute::IndexAttribute);
+    geometry->addAttribute(position);
+    geometry->addAttribute(normal);
+    geometry->addAttribute(index);
+    geometry->setBoundingVolumePositionAttribute(position);
+
+    renderer->setGeometry(geometry);
+}
+
+Qt3DRender::QGeometryRenderer *ScenePlayer::createMesh(Scene *scene, const QString &filename, Qt3DCore::QNode *parent)
+{
+    if (m_optimizeMeshes) {
+        Qt3DRender::QGeometryRenderer *&renderer(scene->optimizedMeshes[filename]);
+        if (!renderer) {
+            // Drawn once the worker is done.
+            Qt3DRender::QGeometryRenderer *r = new Qt3DRender::QGeometryRenderer(scene->root);
+            r->setPrimitiveType(Qt3DRender::QGeometryRenderer::Triangles);
+            QFutureWatcher<OptimizedMesh> *watcher = new QFutureWatcher<OptimizedMesh>(this);
+            QPointer<Qt3DRender::QGeometryRenderer> target(r); // the scene may be gone by then
+            QObject::connect(watcher, &QFutureWatcherBase::finished, this, [watcher, target] {
+                if (target)
+                    setOptimizedGeometry(target, watcher->result());
+                watcher->deleteLater();
+            });
+            const QString fn = QLatin1String(":/") + filename;
+            const bool quantize = m_quantizeNormals;
+            watcher->setFuture(QtConcurrent::run([fn, quantize] { return loadOptimizedMesh(fn, quantize); }));
+            renderer = r;
+        }
+        return renderer;
     }
 
+    Qt3DRender::QMesh *mesh = new Qt3DRender::QMesh(parent);
+#ifdef RTSCPL_TRACE
+    // Mesh loading happens asynchronously in the backend; record it on a separate track.
+    const qint64 meshLoadStart = SceneTracer::instance()->now();
+    const QByteArray meshFn = filename.toUtf8();
+    QObject::connect(mesh, &Qt3DRender::QMesh::statusChanged, [meshFn, meshLoadStart](Qt3DRender::QMesh::Status status) {
+        if (status == Qt3DRender::QMesh::Ready || status == Qt3DRender::QMesh::Error) {
+            SceneTracer *t = SceneTracer::instance();
+            t->addEvent(QByteArrayLiteral("mesh load"), meshLoadStart, t->now() - meshLoadStart,
+                        t->virtualThreadId(QByteArrayLiteral("Qt3D mesh loading")), "file", meshFn);
+        }
+    });
+#endif
+    mesh->setSource(QUrl("qrc:/" + filename));
+    return mesh;
+}
+
+ScenePlayer::ModelComponents ScenePlayer::createModelComponents(Scene *scene,
+                                                                const SceneData &sd,
+                                                                const QByteArray &modelId,
+                                                                const SceneData::Model &mdl,
+                                                                Qt3DCore::QNode *parent)
+{
     const SceneData::Frame &firstFrame(sd.frames.first());
-    if (firstFrame.t != 0) {
-        qWarning("Keyframe @0 is mandatory"); // for now
+    ModelComponents mc;
+
+    // Prefab instances are just a transform for the group.
+    if (!mdl.filename.isEmpty()) {
+        mc.mesh = createMesh(scene, mdl.filename, parent);
+        for (const QString &lodFn : mdl.lodFilenames)
+            mc.lodMeshes.append(createMesh(scene, lodFn, parent));
+        mc.material = createMaterial(scene, parent);
+    }
+    mc.transform = new Qt3DCore::QTransform(parent);
+
+    if (firstFrame.modelChanges.contains(modelId)) {
+        const SceneData::ModelChange &ch(firstFrame.modelChanges[modelId]);
+        Qt3DCore::QTransform *t = mc.transform;
+        if (ch.change & SceneData::ModelChange::Translation)
+            t->setTranslation(ch.translation);
+        if (ch.change & SceneData::ModelChange::Rotation) {
+            t->setRotationX(ch.rotation.x());
+            t->setRotationY(ch.rotation.y());
+            t->setRotationZ(ch.rotation.z());
+        }
+        if (ch.change & SceneData::ModelChange::Scale)
+            t->setScale3D(ch.scale);
+        if ((ch.change & SceneData::ModelChange::Color) && mc.material)
+            setMaterialDiffuse(mc.material, ch.color);
+    }
+
+    return mc;
+}
+
+static void addModelComponents(Qt3DCore::QEntity *entity, const ScenePlayer::ModelComponents &mc)
+{
+    // With levels of detail the meshes go to child entities, see addLevelsOfDetail().
+    if (mc.mesh && mc.lodMeshes.isEmpty())
+        entity->addComponent(mc.mesh);
+    if (mc.material)
+        entity->addComponent(mc.material);
+    entity->addComponent(mc.transform);
+}
+
+Qt3DCore::QEntity *ScenePlayer::addModel(Scene *scene,
+                                         const SceneData &sd,
+                                         const QByteArray &modelId,
+                                         const SceneData::Model &mdl,
+                                         Qt3DCore::QEntity *parentEntity,
+                                         Qt3DAnimation::QClipAnimator **animator,
+                                         const QByteArray &prefab)
+{
+    TRACE_SCOPE_ARG("model", "model", modelId);
+    const bool shared = !prefab.isEmpty();
+    Qt3DCore::QEntity *modelEntity = new Qt3DCore::QEntity(parentEntity);
+    // Lazily instantiated models are shown and hidden by updateLazyModels().
+    if ((shared || !m_lazyInstantiation) && scene->visibilityKeys.contains(modelId))
+        addVisibilityTrack(scene, modelEntity, modelId);
+
+    if (shared) {
+        // Models inside prefabs share one mesh, material, transform and clip
+        // between all instances. The components are owned by the player, which
+        // also runs the animator, so they survive any one instance.
+        ModelComponents &mc(scene->prefabComponents[qMakePair(prefab, modelId)]);
+        if (!mc.transform) {
+            mc = createModelComponents(scene, sd, modelId, mdl, scene->root);
+            scene->modelNodes[modelId] = { mc, m_replay ? nullptr : addAnimations(scene, sd, modelId, scene->root, mc.transform, mc.material) };
+            scene->replayFrame = -1;
+        }
+        addModelComponents(modelEntity, mc);
+        if (!mc.lodMeshes.isEmpty())
+            addLevelsOfDetail(scene, modelEntity, mdl, mc);
+        if (animator)
+            *animator = nullptr;
+        return modelEntity;
+    }
+
+    const ModelComponents mc = createModelComponents(scene, sd, modelId, mdl, nullptr);
+    addModelComponents(modelEntity, mc);
+    if (!mc.lodMeshes.isEmpty())
+        addLevelsOfDetail(scene, modelEntity, mdl, mc);
+
+    Qt3DAnimation::QClipAnimator *a = nullptr;
+    if (m_replay)
+        scene->replayFrame = -1; // pick up the new model on the next frame
+    else
+        a = addAnimations(scene, sd, modelId, modelEntity, mc.transform, mc.material);
+    if (animator)
+        *animator = a;
+    scene->modelNodes[modelId] = { mc, a, modelEntity };
+
+    return modelEntity;
+}
+
+static QVector<qreal> lodThresholds(const QVector<float> &thresholds, bool screenSize, qreal bias)
+{
+    // QLevelOfDetail wants one threshold per level; the last level takes everything beyond.
+    QVector<qreal> result;
+    result.reserve(thresholds.count() + 1);
+    for (float threshold : thresholds)
+        result.append(screenSize ? threshold * bias : threshold / bias);
+    result.append(screenSize ? 0 : std::numeric_limits<qreal>::max());
+    return result;
+}
+
+void ScenePlayer::addLevelsOfDetail(Scene *scene, Qt3DCore::QEntity *entity, const SceneData::Model &mdl, const ModelComponents &mc)
+{
+    Qt3DRender::QCamera *cam = scene->camera;
+    if (!cam) {
+        qWarning("No camera for levels of detail; only the most detailed level will be shown");
+        Qt3DCore::QEntity *level = new Qt3DCore::QEntity(entity);
+        level->addComponent(mc.mesh);
+        level->addComponent(mc.material);
         return;
     }
 
-    // Initial camera settings
-    if (!sd.cameras.isEmpty()) {
-        if (sd.cameras.count() > 1)
-            qWarning("Multiple cameras; only one will be used");
+    // Sized around the model's origin so that the switching follows its animated
+    // transform; the entity has no geometry of its own to take the bounds from.
+    auto radius = m_boundingRadii.find(mdl.filename);
+    if (radius == m_boundingRadii.end())
+        radius = m_boundingRadii.insert(mdl.filename, objBoundingRadius(QLatin1String(":/") + mdl.filename));
 
-        const QByteArray &camId(*sd.cameras.constBegin());
-        SceneData::CameraChange ch = firstFrame.cameraChanges[camId];
+    LodModel lod;
+    lod.thresholds = mdl.lodThresholds;
+    lod.screenSize = mdl.lodScreenSize;
+    const int levelCount = 1 + mc.lodMeshes.count();
+    for (int i = 0; i < levelCount; ++i) {
+        Qt3DCore::QEntity *level = new Qt3DCore::QEntity(entity);
+        level->addComponent(i == 0 ? mc.mesh : mc.lodMeshes[i - 1]);
+        level->addComponent(mc.material);
+        level->setEnabled(i == 0);
+        lod.levels.append(level);
+    }
 
-        Qt3DRender::QCamera *cam = new Qt3DRender::QCamera(this);
-        cam->setProjectionType(Qt3DRender::QCameraLens::PerspectiveProjection);
-        cam->setFieldOfView(45);
-        cam->setAspectRatio(m_aspectRatio);
-        cam->setNearPlane(0.01f);
-        cam->setFarPlane(1000.0f);
-        cam->setUpVector(QVector3D(0.0f, 1.0f, 0.0f));
-        if (ch.change & SceneData::CameraChange::Position)
-            cam->setPosition(ch.position);
-        else
-            cam->setPosition(QVector3D(0, 0, 10));
-        if (ch.change & SceneData::CameraChange::ViewCenter)
-            cam->setViewCenter(ch.viewCenter);
-        else
-            cam->setViewCenter(QVector3D(0, 0, 0));
+    Qt3DRender::QLevelOfDetail *lodComponent = new Qt3DRender::QLevelOfDetail;
+    lodComponent->setCamera(cam);
+    lodComponent->setThresholdType(lod.screenSize ? Qt3DRender::QLevelOfDetail::ProjectedScreenPixelSizeThreshold
+                                                  : Qt3DRender::QLevelOfDetail::DistanceToCameraThreshold);
+    lodComponent->setThresholds(lodThresholds(lod.thresholds, lod.screenSize, effectiveLodBias()));
+    lodComponent->setVolumeOverride(Qt3DRender::QLevelOfDetailBoundingSphere(QVector3D(), *radius));
+    entity->addComponent(lodComponent);
 
-        r->setCamera(cam);
-    } else {
-        qWarning("No camera");
+    if (scene->lodDrawCounts.count() < levelCount)
+        scene->lodDrawCounts.resize(levelCount);
+    ++scene->lodDrawCounts[0];
+    scene->lodModels.insert(lodComponent, lod);
+    if (scene == &m_scene)
+        m_lodDrawCountsDirty = true;
+
+    // The scenes get swapped, so look up which one the component is in now.
+    QObject::connect(lodComponent, &Qt3DRender::QLevelOfDetail::currentIndexChanged, this, [this, lodComponent](int index) {
+        Scene *scene = m_scene.lodModels.contains(lodComponent) ? &m_scene : &m_nextScene;
+        auto it = scene->lodModels.find(lodComponent);
+        if (it == scene->lodModels.end() || index == it->level || index < 0 || index >= it->levels.count())
+            return;
+        it->levels[it->level]->setEnabled(false);
+        it->levels[index]->setEnabled(true);
+        --scene->lodDrawCounts[it->level];
+        ++scene->lodDrawCounts[index];
+        it->level = index;
+        if (scene == &m_scene)
+            m_lodDrawCountsDirty = true;
+    });
+    // Lazily instantiated models come and go.
+    QObject::connect(lodComponent, &QObject::destroyed, this, [this, lodComponent] {
+        Scene *scene = m_scene.lodModels.contains(lodComponent) ? &m_scene : &m_nextScene;
+        auto it = scene->lodModels.find(lodComponent);
+        if (it == scene->lodModels.end())
+            return;
+        --scene->lodDrawCounts[it->level];
+        scene->lodModels.erase(it);
+        if (scene == &m_scene)
+            m_lodDrawCountsDirty = true;
+    });
+}
+
+void ScenePlayer::setLodBias(qreal bias)
+{
+    if (bias <= 0) {
+        qWarning("Invalid LOD bias %f", bias);
+        return;
     }
+    if (m_lodBias == bias)
+        return;
 
-    // Initial light settings
-    for (const QByteArray &lightId : sd.lights) {
-        Qt3DCore::QEntity *lightEntity = new Qt3DCore::QEntity(this);
-        Qt3DRender::QDirectionalLight *light = new Qt3DRender::QDirectionalLight;
-        light->setWorldDirection(QVector3D(0, 0, -1));
-        Qt3DCore::QTransform *t = new Qt3DCore::QTransform;
-        lightEntity->addComponent(light);
-        lightEntity->addComponent(t);
-        if (firstFrame.lightChanges.contains(lightId)) {
-            const SceneData::LightChange &ch(firstFrame.lightChanges[lightId]);
-            if (ch.change & SceneData::LightChange::Position)
-                t->setTranslation(ch.position);
+    m_lodBias = bias;
+    updateLodThresholds();
+    emit lodBiasChanged();
+}
+
+void ScenePlayer::updateLodThresholds()
+{
+    const qreal bias = effectiveLodBias();
+    for (const Scene *scene : { &m_scene, &m_nextScene }) {
+        for (auto it = scene->lodModels.cbegin(), ite = scene->lodModels.cend(); it != ite; ++it)
+            it.key()->setThresholds(lodThresholds(it->thresholds, it->screenSize, bias));
+    }
+}
+
+QVariantList ScenePlayer::lodDrawCounts() const
+{
+    QVariantList counts;
+    for (int count : m_scene.lodDrawCounts)
+        counts.append(count);
+    return counts;
+}
+
+QVector<Qt3DCore::QEntity *> ScenePlayer::addInstanceCells(const SceneData::Model &mdl,
+                                                          Qt3DCore::QEntity *instanceEntity)
+{
+    QVector<Qt3DCore::QEntity *> cells;
+    if (mdl.instanceCount() == 1) {
+        cells.append(instanceEntity);
+        return cells;
+    }
+
+    cells.reserve(mdl.instanceCount());
+    for (int z = 0; z < mdl.instances[2]; ++z) {
+        for (int y = 0; y < mdl.instances[1]; ++y) {
+            for (int x = 0; x < mdl.instances[0]; ++x) {
+                Qt3DCore::QEntity *cell = new Qt3DCore::QEntity(instanceEntity);
+                Qt3DCore::QTransform *t = new Qt3DCore::QTransform;
+                t->setTranslation(QVector3D(x, y, z) * mdl.instanceSpacing);
+                cell->addComponent(t);
+                cells.append(cell);
+            }
         }
     }
+    return cells;
+}
 
-    // Add models and their animations.
-    recursiveAddModels(sd, sd.models, this);
+// The value of the last key at or before pos; visible before the first one.
+static bool visibleAt(const QVector<QPair<int, bool> > &keys, int pos, int *key = nullptr)
+{
+    auto it = std::upper_bound(keys.cbegin(), keys.cend(), pos,
+                               [](int pos, const QPair<int, bool> &k) { return pos < k.first; });
+    const int idx = int(it - keys.cbegin()) - 1;
+    if (key)
+        *key = idx;
+    return idx < 0 || keys[idx].second;
 }
 
-void ScenePlayer::recursiveAddModels(const SceneData &sd,
-                                     const QHash<QByteArray, SceneData::Model> &models,
-                                     Qt3DCore::QEntity *parentEntity)
+// From when a model is first shown until it is hidden for good, going by its
+// visible keys. firstTime is INT_MAX if it is never shown.
+static void shownSpan(const QVector<QPair<int, bool> > &keys, int *firstTime, int *lastTime)
 {
-    const SceneData::Frame &firstFrame(sd.frames.first());
+    *firstTime = keys.isEmpty() || keys.first().first > 0 ? 0 : INT_MAX;
+    for (const QPair<int, bool> &k : keys) {
+        if (k.second && *firstTime == INT_MAX)
+            *firstTime = k.first;
+    }
+    *lastTime = !keys.isEmpty() && !keys.last().second ? keys.last().first : INT_MAX;
+}
+
+void ScenePlayer::setupLazyModels(const SceneData &sd)
+{
+    m_lazyModels.clear();
+    gatherLazyModels(sd.models, -1);
+}
 
+void ScenePlayer::gatherLazyModels(const QHash<QByteArray, SceneData::Model> &models,
+                                   int parent)
+{
     for (auto it = models.cbegin(), ite = models.cend(); it != ite; ++it) {
-        const SceneData::Model &mdl(it.value());
+        const int idx = m_lazyModels.count();
+        LazyModel lm;
+        lm.id = it.key();
+        lm.model = &it.value();
+        lm.parent = parent;
+        shownSpan(m_scene.visibilityKeys.value(it.key()), &lm.firstTime, &lm.lastTime);
+        m_lazyModels.append(lm);
 
-        Qt3DCore::QEntity *modelEntity = new Qt3DCore::QEntity(parentEntity);
-        Qt3DRender::QMesh *mesh = new Qt3DRender::QMesh;
-        mesh->setSource(QUrl("qrc:/" + mdl.filename));
-        Qt3DExtras::QPhongMaterial *mat = new Qt3DExtras::QPhongMaterial;
-        Qt3DCore::QTransform *t = new Qt3DCore::QTransform;
-        modelEntity->addComponent(mesh);
-        modelEntity->addComponent(mat);
-        modelEntity->addComponent(t);
-
-        if (firstFrame.modelChanges.contains(it.key())) {
-            const SceneData::ModelChange &ch(firstFrame.modelChanges[it.key()]);
-            if (ch.change & SceneData::ModelChange::Translation)
-                t->setTranslation(ch.translation);
-            if (ch.change & SceneData::ModelChange::Rotation) {
-                t->setRotationX(ch.rotation.x());
-                t->setRotationY(ch.rotation.y());
-                t->setRotationZ(ch.rotation.z());
+        // A hidden model hides its children, so their own spans are enough.
+        gatherLazyModels(it.value().childModels, idx);
+        m_lazyModels[idx].subtreeEnd = m_lazyModels.count();
+    }
+}
+
+void ScenePlayer::updateLazyModels(int pos)
+{
+    const SceneData &sd(m_sceneData);
+    const int builtModels = m_builtModels;
+    QElapsedTimer timer;
+    timer.start();
+    const qint64 budget = m_buildBudget * qint64(1000000);
+    bool budgetLeft = true;
+
+    // Pre-order, so parents are always handled before their children.
+    for (int idx = 0; idx < m_lazyModels.count(); ++idx) {
+        LazyModel &lm(m_lazyModels[idx]);
+
+        const bool unload = m_unloadInactive && lm.lastTime != INT_MAX;
+        const bool active = pos >= lm.firstTime - m_lazyLeadTime && (!unload || pos < lm.lastTime);
+
+        if (active && !lm.entity) {
+            Qt3DCore::QEntity *parentEntity = lm.parent >= 0 ? m_lazyModels[lm.parent].entity : m_scene.root;
+            if (!parentEntity || !budgetLeft)
+                continue;
+            lm.entity = addModel(&m_scene, sd, lm.id, *lm.model, parentEntity, &lm.animator);
+            ++m_builtModels;
+            if (!lm.model->prefab.isEmpty()) {
+                const SceneData::Prefab &prefab(sd.prefabs[lm.model->prefab]);
+                for (Qt3DCore::QEntity *cell : addInstanceCells(*lm.model, lm.entity))
+                    recursiveAddModels(&m_scene, sd, prefab.models, cell, lm.model->prefab);
+                m_builtModels += lm.model->instanceCount() * countModels(sd, prefab.models);
             }
-            if (ch.change & SceneData::ModelChange::Scale)
-                t->setScale3D(ch.scale);
-            if (ch.change & SceneData::ModelChange::Color)
-                mat->setDiffuse(ch.color);
+            // The rest is picked up in the next frame(s).
+            if (budget > 0 && timer.nsecsElapsed() >= budget)
+                budgetLeft = false;
+        } else if (!active && lm.entity) {
+            for (int i = idx; i < lm.subtreeEnd; ++i) {
+                LazyModel &child(m_lazyModels[i]);
+                if (child.entity) {
+                    --m_builtModels;
+                    m_scene.modelNodes.remove(child.id);
+                    if (!child.model->prefab.isEmpty())
+                        m_builtModels -= child.model->instanceCount() * countModels(sd, sd.prefabs[child.model->prefab].models);
+                }
+                if (child.animator) {
+                    m_scene.animators.removeOne(child.animator);
+                    m_scene.suspendedAnimators.remove(child.animator);
+                }
+                child.animator = nullptr;
+                if (i != idx)
+                    child.entity = nullptr;
+            }
+            delete lm.entity; // takes the children with it
+            lm.entity = nullptr;
+        }
+
+        // Created slightly ahead of time, shown as the visible keys say.
+        if (lm.entity) {
+            const bool shown = visibleAt(m_scene.visibilityKeys.value(lm.id), pos);
+            if (lm.entity->isEnabled() != shown)
+                setEntityShown(lm.entity, shown);
         }
+    }
 
-        addAnimations(sd, it.key(), modelEntity, t, mat);
+    if (m_builtModels != builtModels)
+        emit buildProgressChanged(m_builtModels, m_totalModels);
+}
+
+void ScenePlayer::addVisibilityTrack(Scene *scene, Qt3DCore::QEntity *entity, const QByteArray &modelId)
+{
+    // The animators are not there yet; they start out suspended if hidden, see startAnimator().
+    VisibilityTrack track;
+    track.entity = entity;
+    track.modelId = modelId;
+    if (!visibleAt(scene->visibilityKeys[modelId], scene != &m_scene ? 0 : position(), &track.key))
+        entity->setEnabled(false);
+    scene->visibility.append(track);
+}
 
-        recursiveAddModels(sd, mdl.childModels, modelEntity);
+void ScenePlayer::updateVisibility(int pos)
+{
+    for (int i = 0; i < m_scene.visibility.count(); ) {
+        VisibilityTrack &track(m_scene.visibility[i]);
+        if (!track.entity) {
+            m_scene.visibility.remove(i);
+            continue;
+        }
+        // Nothing to do until the playhead crosses a key.
+        int key;
+        const bool visible = visibleAt(m_scene.visibilityKeys[track.modelId], pos, &key);
+        if (key != track.key) {
+            track.key = key;
+            if (track.entity->isEnabled() != visible)
+                setEntityShown(track.entity, visible);
+        }
+        ++i;
     }
 }
 
-void ScenePlayer::addAnimations(const SceneData &sd,
-                                const QByteArray &modelId,
-                                Qt3DCore::QEntity *modelEntity,
-                                Qt3DCore::QTransform *modelTransform,
-                                Qt3DExtras::QPhongMaterial *modelMaterial)
+// A disabled entity takes its subtree out of rendering, but the animators in it would
+// still be evaluated, so those are paused until everything above them is shown again.
+void ScenePlayer::setEntityShown(Qt3DCore::QEntity *entity, bool shown)
 {
-    int changes = 0;
-    for (const SceneData::Frame &f : sd.frames) {
-        if (f.t != 0 && f.modelChanges.contains(modelId)) {
-            const SceneData::ModelChange &ch(f.modelChanges[modelId]);
-            changes |= ch.change;
+    entity->setEnabled(shown);
+    const float normalizedTime = m_duration > 0 ? position() / float(m_duration) : 0;
+    const auto animators = entity->findChildren<Qt3DAnimation::QClipAnimator *>();
+    for (Qt3DAnimation::QClipAnimator *animator : animators) {
+        if (shown) {
+            if (!m_scene.suspendedAnimators.contains(animator)
+                    || !isShown(&m_scene, qobject_cast<Qt3DCore::QEntity *>(animator->parent())))
+                continue;
+            m_scene.suspendedAnimators.remove(animator);
+            animator->setNormalizedTime(normalizedTime);
+            animator->setRunning(m_playing);
+        } else if (!m_scene.suspendedAnimators.contains(animator) && m_scene.animators.contains(animator)) {
+            m_scene.suspendedAnimators.insert(animator);
+            animator->setRunning(false);
         }
     }
+}
+
+// Whether the entity and all its ancestors up to the scene root are enabled.
+bool ScenePlayer::isShown(const Scene *scene, Qt3DCore::QEntity *entity) const
+{
+    for (; entity && entity != scene->root; entity = entity->parentEntity()) {
+        if (!entity->isEnabled())
+            return false;
+    }
+    return true;
+}
+
+Qt3DAnimation::QClipAnimator *ScenePlayer::addAnimations(Scene *scene,
+                                                         const SceneData &sd,
+                                                         const QByteArray &modelId,
+                                                         Qt3DCore::QEntity *modelEntity,
+                                                         Qt3DCore::QTransform *modelTransform,
+                                                         Qt3DRender::QMaterial *modelMaterial)
+{
+    TRACE_SCOPE_ARG("addAnimations", "model", modelId);
+    const bool streamed = m_streaming && scene == &m_scene;
+    int changes = streamed ? m_streamIndex.modelKeys.value(modelId).changes
+                           : ClipBuilder::changes(sd, modelId);
+    changes &= SceneData::ModelChange::Clip; // visibility is stepped through in updateVisibility()
+    if (!modelMaterial)
+        changes &= ~SceneData::ModelChange::Color;
     if (!changes)
-        return;
+        return nullptr;
 
     Qt3DAnimation::QClipAnimator *animator = new Qt3DAnimation::QClipAnimator;
     Qt3DAnimation::QChannelMapper *mapper = new Qt3DAnimation::QChannelMapper;
@@ -257,183 +2017,19 @@ void ScenePlayer::addAnimations(const SceneData &sd,
     animator->setChannelMapper(mapper);
 
     Qt3DAnimation::QAnimationClip *clip = new Qt3DAnimation::QAnimationClip;
-    Qt3DAnimation::QAnimationClipData clipData;
-
-    Qt3DAnimation::QChannel trans(QStringLiteral("Translation"));
-    Qt3DAnimation::QChannelComponent transX(QStringLiteral("Translation X"));
-    Qt3DAnimation::QChannelComponent transY(QStringLiteral("Translation Y"));
-    Qt3DAnimation::QChannelComponent transZ(QStringLiteral("Translation Z"));
-
-    Qt3DAnimation::QChannel rot(QStringLiteral("Rotation"));
-    Qt3DAnimation::QChannelComponent rotX(QStringLiteral("Rotation X"));
-    Qt3DAnimation::QChannelComponent rotY(QStringLiteral("Rotation Y"));
-    Qt3DAnimation::QChannelComponent rotZ(QStringLiteral("Rotation Z"));
-    Qt3DAnimation::QChannelComponent rotW(QStringLiteral("Rotation W"));
-
-    Qt3DAnimation::QChannel scale(QStringLiteral("Scale"));
-    Qt3DAnimation::QChannelComponent scaleX(QStringLiteral("Scale X"));
-    Qt3DAnimation::QChannelComponent scaleY(QStringLiteral("Scale Y"));
-    Qt3DAnimation::QChannelComponent scaleZ(QStringLiteral("Scale Z"));
-
-    Qt3DAnimation::QChannel color(QStringLiteral("Color"));
-    Qt3DAnimation::QChannelComponent colorR(QStringLiteral("Color R"));
-    Qt3DAnimation::QChannelComponent colorG(QStringLiteral("Color G"));
-    Qt3DAnimation::QChannelComponent colorB(QStringLiteral("Color B"));
-
-    QVector3D curTrans = modelTransform->translation();
-    QQuaternion curRot = modelTransform->rotation();
-    QVector3D curScale = modelTransform->scale3D();
-    QColor curColor = modelMaterial->diffuse();
-
-    // First frame.
-    transX.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(0, curTrans.x())));
-    transY.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(0, curTrans.y())));
-    transZ.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(0, curTrans.z())));
-    rotX.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(0, curRot.x())));
-    rotY.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(0, curRot.y())));
-    rotZ.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(0, curRot.z())));
-    rotW.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(0, curRot.scalar())));
-    scaleX.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(0, curScale.x())));
-    scaleY.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(0, curScale.y())));
-    scaleZ.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(0, curScale.z())));
-    colorR.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(0, curColor.redF())));
-    colorG.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(0, curColor.greenF())));
-    colorB.appendKeyFrame(Qt3DAnimation::QKeyFrame(QVector2D(0, curColor.blueF())));
-
-    for (const SceneData::Frame &f : sd.frames) {
-        if (f.t == 0)
-            continue;
-
-        if (!f.modelChanges.contains(modelId))
-            continue;
-
-        const SceneData::ModelChange &ch(f.modelChanges[modelId]);
-
-        // Channels must be fully specified, meaning 3 (or 4) components are required always for t/r/s.
-        // Time values are, surprisingly enough, in seconds.
-
-#define T(p) QVector2D(f.t / 1000.0f, p)
-#define FINAL_T(p) QVector2D(sd.totalTime / 1000.0f, p)
-
-        if (ch.change & SceneData::ModelChange::Translation) {
-            if (ch.change & SceneData::ModelChange::TranslationX) {
-                curTrans.setX(ch.translation.x());
-                transX.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(ch.translation.x())));
-            } else {
-                transX.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(curTrans.x())));
-            }
-
-            if (ch.change & SceneData::ModelChange::TranslationY) {
-                curTrans.setY(ch.translation.y());
-                transY.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(ch.translation.y())));
-            } else {
-                transY.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(curTrans.y())));
-            }
-
-            if (ch.change & SceneData::ModelChange::TranslationZ) {
-                curTrans.setZ(ch.translation.z());
-                transZ.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(ch.translation.z())));
-            } else {
-                transZ.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(curTrans.z())));
-            }
-        }
-
-        if (ch.change & SceneData::ModelChange::Rotation) {
-            QVector3D r = curRot.toEulerAngles();
-            if (ch.change & SceneData::ModelChange::RotationX)
-                r.setX(ch.rotation.x());
-            if (ch.change & SceneData::ModelChange::RotationY)
-                r.setY(ch.rotation.y());
-            if (ch.change & SceneData::ModelChange::RotationZ)
-                r.setZ(ch.rotation.z());
-            curRot = QQuaternion::fromEulerAngles(r);
-            rotX.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(curRot.x())));
-            rotY.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(curRot.y())));
-            rotZ.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(curRot.z())));
-            rotW.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(curRot.scalar())));
-        }
-
-        if (ch.change & SceneData::ModelChange::Scale) {
-            if (ch.change & SceneData::ModelChange::ScaleX) {
-                curScale.setX(ch.scale.x());
-                scaleX.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(ch.scale.x())));
-            } else {
-                scaleX.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(curScale.x())));
-            }
-
-            if (ch.change & SceneData::ModelChange::ScaleY) {
-                curScale.setY(ch.scale.y());
-                scaleY.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(ch.scale.y())));
-            } else {
-                scaleY.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(curScale.y())));
-            }
-
-            if (ch.change & SceneData::ModelChange::ScaleZ) {
-                curScale.setZ(ch.scale.z());
-                scaleZ.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(ch.scale.z())));
-            } else {
-                scaleZ.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(curScale.z())));
-            }
-        }
-
-        if (ch.change & SceneData::ModelChange::Color) {
-            curColor = ch.color;
-            colorR.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(curColor.redF())));
-            colorG.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(curColor.greenF())));
-            colorB.appendKeyFrame(Qt3DAnimation::QKeyFrame(T(curColor.blueF())));
-        }
+    if (streamed) {
+        // Only the current window; replaced as the playhead moves on, see updateStreaming().
+        clip->setClipData(m_window.clips.value(modelId));
+    } else if (scene->clips.contains(modelId)) {
+        clip->setClipData(scene->clips.value(modelId));
+    } else {
+        const ClipBuilder initial(modelTransform->translation(), modelTransform->rotation(), modelTransform->scale3D(),
+                                  modelMaterial ? materialDiffuse(modelMaterial) : QColor());
+        clip->setClipData(ClipBuilder::build(sd, modelId, initial, changes));
     }
 
-    // Last frame.
-    transX.appendKeyFrame(Qt3DAnimation::QKeyFrame(FINAL_T(curTrans.x())));
-    transY.appendKeyFrame(Qt3DAnimation::QKeyFrame(FINAL_T(curTrans. y())));
-    transZ.appendKeyFrame(Qt3DAnimation::QKeyFrame(FINAL_T(curTrans.z())));
-    rotX.appendKeyFrame(Qt3DAnimation::QKeyFrame(FINAL_T(curRot.x())));
-    rotY.appendKeyFrame(Qt3DAnimation::QKeyFrame(FINAL_T(curRot.y())));
-    rotZ.appendKeyFrame(Qt3DAnimation::QKeyFrame(FINAL_T(curRot.z())));
-    rotW.appendKeyFrame(Qt3DAnimation::QKeyFrame(FINAL_T(curRot.scalar())));
-    scaleX.appendKeyFrame(Qt3DAnimation::QKeyFrame(FINAL_T(curScale.x())));
-    scaleY.appendKeyFrame(Qt3DAnimation::QKeyFrame(FINAL_T(curScale.y())));
-    scaleZ.appendKeyFrame(Qt3DAnimation::QKeyFrame(FINAL_T(curScale.z())));
-    colorR.appendKeyFrame(Qt3DAnimation::QKeyFrame(FINAL_T(curColor.redF())));
-    colorG.appendKeyFrame(Qt3DAnimation::QKeyFrame(FINAL_T(curColor.greenF())));
-    colorB.appendKeyFrame(Qt3DAnimation::QKeyFrame(FINAL_T(curColor.blueF())));
-
-    trans.appendChannelComponent(transX);
-    trans.appendChannelComponent(transY);
-    trans.appendChannelComponent(transZ);
-
-    // QQuaternion(scalar, x, y, z)
-    rot.appendChannelComponent(rotW);
-    rot.appendChannelComponent(rotX);
-    rot.appendChannelComponent(rotY);
-    rot.appendChannelComponent(rotZ);
-
-    scale.appendChannelComponent(scaleX);
-    scale.appendChannelComponent(scaleY);
-    scale.appendChannelComponent(scaleZ);
-
-    color.appendChannelComponent(colorR);
-    color.appendChannelComponent(colorG);
-    color.appendChannelComponent(colorB);
-
-    if (changes & SceneData::ModelChange::Translation)
-        clipData.appendChannel(trans);
-
-    if (changes & SceneData::ModelChange::Rotation)
-        clipData.appendChannel(rot);
-
-    if (changes & SceneData::ModelChange::Scale)
-        clipData.appendChannel(scale);
-
-    if (changes & SceneData::ModelChange::Color)
-        clipData.appendChannel(color);
-
-    clip->setClipData(clipData);
-
     animator->setClip(clip);
-    animator->setLoopCount(9999);
-    animator->setRunning(true);
-
-    modelEntity->addComponent(animator);
+    modelEntity->addComponent(animator); // before starting, to know if it is hidden
+    startAnimator(scene, animator);
+    return animator;
 }
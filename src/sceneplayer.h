@@ -53,14 +53,39 @@
 
 #include <Qt3DCore/QEntity>
 #include <QFutureWatcher>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QSize>
+#include <QVariantList>
+#include <QStringList>
+#include <QPointer>
+#include <QSet>
+#include <climits>
 #include "twospaceparser.h"
+#include "scenerecording.h"
+#include "meshloader.h"
+#include "clipbuilder.h"
 
 namespace Qt3DCore {
 class QTransform;
 }
-namespace Qt3DExtras {
-class QPhongMaterial;
+namespace Qt3DRender {
+class QCamera;
+class QGeometryRenderer;
+class QLevelOfDetail;
+class QMaterial;
+class QRenderSettings;
 }
+namespace Qt3DAnimation {
+class QClock;
+class QClipAnimator;
+}
+namespace Qt3DLogic {
+class QFrameAction;
+}
+class LiveControl;
+class ClusteredLighting;
+class MultiViewRenderer;
 
 class ScenePlayer : public Qt3DCore::QEntity
 {
@@ -68,6 +93,37 @@ class ScenePlayer : public Qt3DCore::QEntity
     Q_PROPERTY(QString source READ filename WRITE setFilename NOTIFY filenameChanged)
     Q_PROPERTY(QObject *renderer READ renderer WRITE setRenderer)
     Q_PROPERTY(qreal aspectRatio READ aspectRatio WRITE setAspectRatio)
+    Q_PROPERTY(bool playing READ isPlaying WRITE setPlaying NOTIFY playingChanged)
+    Q_PROPERTY(int position READ position WRITE seek NOTIFY positionChanged)
+    Q_PROPERTY(int duration READ duration NOTIFY durationChanged)
+    Q_PROPERTY(qreal playbackRate READ playbackRate WRITE setPlaybackRate NOTIFY playbackRateChanged)
+    Q_PROPERTY(bool loop READ loop WRITE setLoop NOTIFY loopChanged)
+    Q_PROPERTY(bool lazyInstantiation READ lazyInstantiation WRITE setLazyInstantiation)
+    Q_PROPERTY(bool unloadInactive READ unloadInactive WRITE setUnloadInactive)
+    Q_PROPERTY(int lazyLeadTime READ lazyLeadTime WRITE setLazyLeadTime)
+    Q_PROPERTY(int buildBudget READ buildBudget WRITE setBuildBudget)
+    Q_PROPERTY(qreal buildProgress READ buildProgress NOTIFY buildProgressChanged)
+    Q_PROPERTY(QString liveSource READ liveSource WRITE setLiveSource)
+    Q_PROPERTY(qreal liveLatency READ liveLatency NOTIFY liveLatencyChanged)
+    Q_PROPERTY(qreal liveLatencyMax READ liveLatencyMax NOTIFY liveLatencyChanged)
+    Q_PROPERTY(QString recordFile READ recordFile WRITE setRecordFile)
+    Q_PROPERTY(int recordInterval READ recordInterval WRITE setRecordInterval)
+    Q_PROPERTY(QString replayFile READ replayFile WRITE setReplayFile)
+    Q_PROPERTY(bool mergeStatic READ mergeStatic WRITE setMergeStatic)
+    Q_PROPERTY(int streamWindow READ streamWindow WRITE setStreamWindow)
+    Q_PROPERTY(QObject *renderSettings READ renderSettings WRITE setRenderSettings)
+    Q_PROPERTY(bool idle READ isIdle NOTIFY idleChanged)
+    Q_PROPERTY(int idleTime READ idleTime NOTIFY idleChanged)
+    Q_PROPERTY(bool clusteredLighting READ clusteredLighting WRITE setClusteredLighting)
+    Q_PROPERTY(QSize surfaceSize READ surfaceSize WRITE setSurfaceSize)
+    Q_PROPERTY(int benchmark READ benchmark WRITE setBenchmark)
+    Q_PROPERTY(qreal lodBias READ lodBias WRITE setLodBias NOTIFY lodBiasChanged)
+    Q_PROPERTY(QVariantList lodDrawCounts READ lodDrawCounts NOTIFY lodDrawCountsChanged)
+    Q_PROPERTY(bool optimizeMeshes READ optimizeMeshes WRITE setOptimizeMeshes)
+    Q_PROPERTY(bool quantizeNormals READ quantizeNormals WRITE setQuantizeNormals)
+    Q_PROPERTY(QStringList playlist READ playlist WRITE setPlaylist NOTIFY playlistChanged)
+    Q_PROPERTY(qreal targetFrameTime READ targetFrameTime WRITE setTargetFrameTime)
+    Q_PROPERTY(int qualityLevel READ qualityLevel NOTIFY qualityLevelChanged)
 
 public:
     explicit ScenePlayer(QNode *parent = nullptr);
@@ -82,25 +138,420 @@ public:
     qreal aspectRatio() const { return m_aspectRatio; }
     void setAspectRatio(qreal ratio);
 
+    // Playback is driven by one QClock shared by all animators. Positions are in ms.
+    bool isPlaying() const { return m_playing; }
+    void setPlaying(bool playing);
+
+    int position() const;
+    void seek(int pos);
+
+    int duration() const { return m_duration; }
+
+    qreal playbackRate() const { return m_playbackRate; }
+    void setPlaybackRate(qreal rate);
+
+    bool loop() const { return m_loop; }
+    void setLoop(bool loop);
+
+    // With lazy instantiation a model is created lazyLeadTime ms before it is
+    // first shown, so models hidden by a visible 0 key at t=0 cost nothing until
+    // a visible 1 key. With unloadInactive it is destroyed again once its last
+    // visible key hides it for good. What is drawn is the same as without.
+    // Takes effect on the next load.
+    bool lazyInstantiation() const { return m_lazyInstantiation; }
+    void setLazyInstantiation(bool lazy) { m_lazyInstantiation = lazy; }
+
+    bool unloadInactive() const { return m_unloadInactive; }
+    void setUnloadInactive(bool unload) { m_unloadInactive = unload; }
+
+    int lazyLeadTime() const { return m_lazyLeadTime; }
+    void setLazyLeadTime(int ms) { m_lazyLeadTime = ms; }
+
+    // Per-frame time budget in ms for creating entities. With 0 the whole scene
+    // is built at once when loading finishes. Takes effect on the next load.
+    int buildBudget() const { return m_buildBudget; }
+    void setBuildBudget(int ms) { m_buildBudget = ms; }
+
+    // Fraction of the models that currently have their entities created.
+    qreal buildProgress() const;
+
+    // Local socket name (or "-" for stdin) to accept live model property changes
+    // from. A model that receives live changes is no longer driven by its clip.
+    QString liveSource() const { return m_liveSource; }
+    void setLiveSource(const QString &source);
+
+    // Average and maximum ms from receipt to applying a live change, over the last second.
+    qreal liveLatency() const { return m_liveLatency; }
+    qreal liveLatencyMax() const { return m_liveLatencyMax; }
+
+    // Records the evaluated transform and color of every model each recordInterval
+    // ms of playback, for one pass over the timeline. Frames are taken when the
+    // playhead passes an interval boundary, so a slow frame rate skips some.
+    // Takes effect on the next load.
+    QString recordFile() const { return m_recordFile; }
+    void setRecordFile(const QString &fn) { m_recordFile = fn; }
+
+    int recordInterval() const { return m_recordInterval; }
+    void setRecordInterval(int ms) { m_recordInterval = qMax(1, ms); }
+
+    // Plays back a recording instead of the keyframe animations. The scene file
+    // still provides the models. Takes effect on the next load.
+    QString replayFile() const { return m_replayFile; }
+    void setReplayFile(const QString &fn) { m_replayFile = fn; }
+
+    // Top-level model subtrees without keyframes after t=0 are baked into world
+    // space and merged into one geometry per color instead of getting their own
+    // entities. Such models cannot be targeted by live changes or recorded.
+    // Until the merge is done the original models are shown, except with
+    // lazyInstantiation or buildBudget. Takes effect on the next load.
+    bool mergeStatic() const { return m_mergeStatic; }
+    void setMergeStatic(bool merge) { m_mergeStatic = merge; }
+
+    // With a non-zero window length in ms the keyframes are not kept in memory.
+    // The file is indexed and the clips are built on a worker thread for one
+    // window of the timeline at a time, the next one ahead of the playhead.
+    // Seeking outside the prefetched windows reads from the beginning of the
+    // file again. Takes effect on the next load.
+    int streamWindow() const { return m_streamWindow; }
+    void setStreamWindow(int ms);
+
+    // When set, the render policy is switched to on-demand while paused and while
+    // no model property changes between keyframes, and back to continuous
+    // rendering shortly before the next change. Scenes with several cameras also
+    // need it, to switch the active frame graph to one viewport per camera.
+    QObject *renderSettings() const { return m_renderSettings; }
+    void setRenderSettings(QObject *settings);
+
+    bool isIdle() const { return m_idle; }
+    // Total ms spent rendering on demand.
+    int idleTime() const;
+
+    // Point lights are assigned to screen tiles on the CPU and shaded with a
+    // custom material instead of being Qt3D lights, which the default materials
+    // limit to 8. surfaceSize, in pixels, is needed for the tiles. Takes effect
+    // on the next load.
+    bool clusteredLighting() const { return m_clusteredLighting; }
+    void setClusteredLighting(bool clustered) { m_clusteredLighting = clustered; }
+
+    QSize surfaceSize() const { return m_surfaceSize; }
+    void setSurfaceSize(const QSize &size) { m_surfaceSize = size; }
+
+    // Measures frame times for this many seconds once the scene is built, logs
+    // them and emits benchmarkFinished(). Rendering is continuous meanwhile.
+    int benchmark() const { return m_benchmark; }
+    void setBenchmark(int seconds) { m_benchmark = seconds; }
+
+    // Scales the switch distances and screen sizes of models with levels of
+    // detail. Above 1 lower detail levels are used sooner.
+    qreal lodBias() const { return m_lodBias; }
+    void setLodBias(qreal bias);
+
+    // Number of models with levels of detail currently drawn at each level.
+    QVariantList lodDrawCounts() const;
+
+    // Assets are loaded on worker threads instead of by QMesh, with duplicate
+    // vertices welded, the triangles reordered for the vertex cache and for less
+    // overdraw, and the vertices in the order of use. quantizeNormals stores
+    // the normals as half floats. Both take effect on the next load.
+    bool optimizeMeshes() const { return m_optimizeMeshes; }
+    void setOptimizeMeshes(bool optimize) { m_optimizeMeshes = optimize; }
+
+    bool quantizeNormals() const { return m_quantizeNormals; }
+    void setQuantizeNormals(bool quantize) { m_quantizeNormals = quantize; }
+
+    // Scene files played one after the other, starting over after the last one.
+    // Each scene plays once regardless of loop. While one plays the next is
+    // parsed and, unless lazyInstantiation, buildBudget, streamWindow,
+    // mergeStatic, recordFile or replayFile is set, also built in the background
+    // (meshes, clips and entities) so that the switch is immediate. At most one
+    // scene is prepared ahead.
+    QStringList playlist() const { return m_playlist; }
+    void setPlaylist(const QStringList &files);
+
+    // With a target frame time in ms the measured frame times are averaged every
+    // half second, and the quality is lowered a level after a couple of averages
+    // over the target, and raised again after several well under it. Each level
+    // switches to lower levels of detail sooner (on top of lodBias) and, with
+    // clusteredLighting, shades fewer point lights. 0 turns this off and restores
+    // full quality. Must not be below the display's refresh interval with vsync.
+    qreal targetFrameTime() const { return m_targetFrameTime; }
+    void setTargetFrameTime(qreal ms);
+
+    // 0 is full quality, see targetFrameTime.
+    int qualityLevel() const { return m_qualityLevel; }
+
+    Q_INVOKABLE void play() { setPlaying(true); }
+    Q_INVOKABLE void pause() { setPlaying(false); }
+
+    struct ModelComponents {
+        Qt3DRender::QGeometryRenderer *mesh = nullptr; // QMesh unless optimizeMeshes
+        Qt3DRender::QMaterial *material = nullptr; // QPhongMaterial or ClusteredLightMaterial
+        Qt3DCore::QTransform *transform = nullptr;
+        QVector<Qt3DRender::QGeometryRenderer *> lodMeshes; // detail levels after mesh
+    };
+
 signals:
     void filenameChanged();
+    void playingChanged();
+    void positionChanged();
+    void durationChanged();
+    void playbackRateChanged();
+    void loopChanged();
+    void buildProgressChanged(int built, int total);
+    void liveLatencyChanged();
+    void idleChanged();
+    void benchmarkFinished();
+    void lodBiasChanged();
+    void lodDrawCountsChanged();
+    void playlistChanged();
+    void qualityLevelChanged();
 
 private:
+    struct Scene;
+
+    void onFrame(float dt);
+    void startAnimator(Scene *scene, Qt3DAnimation::QClipAnimator *animator);
+    void resetPlayhead(int pos);
     void setupScene(const SceneData &sd);
-    void recursiveAddModels(const SceneData &sd,
+    bool createSceneRoot(Scene *scene, const SceneData &sd, bool enabled);
+    void startTimeline(const SceneData &sd);
+    void addPlayheadAnimator();
+    void onPlayheadTime(float normalizedTime);
+    void destroyScene(Scene *scene);
+    void applyCameras();
+    bool canPrepareScenes() const;
+    void prefetchNextScene();
+    void onPrefetchParsed();
+    void onPrefetchClipsBuilt();
+    void advancePlaylist();
+    bool finishTimeline();
+    void recursiveAddModels(Scene *scene,
+                            const SceneData &sd,
                             const QHash<QByteArray, SceneData::Model> &models,
-                            Qt3DCore::QEntity *parentEntity);
-    void addAnimations(const SceneData &sd,
-                       const QByteArray &modelId,
-                       Qt3DCore::QEntity *modelEntity,
-                       Qt3DCore::QTransform *modelTransform,
-                       Qt3DExtras::QPhongMaterial *modelMaterial);
+                            Qt3DCore::QEntity *parentEntity,
+                            const QByteArray &prefab); // empty outside prefabs
+    ModelComponents createModelComponents(Scene *scene,
+                                          const SceneData &sd,
+                                          const QByteArray &modelId,
+                                          const SceneData::Model &mdl,
+                                          Qt3DCore::QNode *parent);
+    Qt3DCore::QEntity *addModel(Scene *scene,
+                                const SceneData &sd,
+                                const QByteArray &modelId,
+                                const SceneData::Model &mdl,
+                                Qt3DCore::QEntity *parentEntity,
+                                Qt3DAnimation::QClipAnimator **animator = nullptr,
+                                const QByteArray &prefab = QByteArray());
+    QVector<Qt3DCore::QEntity *> addInstanceCells(const SceneData::Model &mdl,
+                                                  Qt3DCore::QEntity *instanceEntity);
+    Qt3DAnimation::QClipAnimator *addAnimations(Scene *scene,
+                                                const SceneData &sd,
+                                                const QByteArray &modelId,
+                                                Qt3DCore::QEntity *modelEntity,
+                                                Qt3DCore::QTransform *modelTransform,
+                                                Qt3DRender::QMaterial *modelMaterial);
+    static int countModels(const SceneData &sd, const QHash<QByteArray, SceneData::Model> &models);
+    void enqueueModels(Scene *scene,
+                       const QHash<QByteArray, SceneData::Model> &models,
+                       Qt3DCore::QEntity *parentEntity,
+                       const QByteArray &prefab);
+    void buildPendingModels(Scene *scene, const SceneData &sd, qint64 budget);
+    void buildNextScene(qint64 budget);
+    void setupLazyModels(const SceneData &sd);
+    void gatherLazyModels(const QHash<QByteArray, SceneData::Model> &models,
+                          int parent);
+    void updateLazyModels(int pos);
+    void addVisibilityTrack(Scene *scene, Qt3DCore::QEntity *entity, const QByteArray &modelId);
+    void updateVisibility(int pos);
+    void setEntityShown(Qt3DCore::QEntity *entity, bool shown);
+    bool isShown(const Scene *scene, Qt3DCore::QEntity *entity) const;
+    void applyLiveChanges();
+    static void applyModelChange(const ModelComponents &mc, const SceneData::ModelChange &ch);
+    static void gatherRecordedModels(const QHash<QByteArray, SceneData::Model> &models, int parent,
+                                     QByteArrayList *ids, QVector<int> *parents);
+    void setupRecording(const SceneData &sd);
+    void recordFrame(int pos);
+    void applyReplay(int pos);
+    void mergeStaticModels(const SceneData &sd, QHash<QByteArray, SceneData::Model> *models);
+    void addMergedGeometry();
+    void onIndexReady();
+    void requestWindow(int index, bool resume);
+    void onWindowBuilt();
+    void updateStreaming(int pos);
+    void applyWindow();
+    void updateRenderPolicy();
+    int untilDue(int pos) const;
+    void onWake();
+    void setIdle(bool idle);
+    Qt3DRender::QMaterial *createMaterial(Scene *scene, Qt3DCore::QNode *parent);
+    void updateBenchmark(float dt);
+    void updateQuality(float dt);
+    void setQualityLevel(int level, float frameTime);
+    qreal effectiveLodBias() const;
+    void updateLodThresholds();
+    Qt3DRender::QGeometryRenderer *createMesh(Scene *scene, const QString &filename, Qt3DCore::QNode *parent);
+    void addLevelsOfDetail(Scene *scene, Qt3DCore::QEntity *entity, const SceneData::Model &mdl, const ModelComponents &mc);
 
     QString m_filename;
     QScopedPointer<SceneParser> m_parser;
     QFutureWatcher<SceneData> m_watcher;
     QObject *m_renderer = nullptr;
+    MultiViewRenderer *m_multiView = nullptr; // active frame graph while there are several cameras
     qreal m_aspectRatio = 16 / 9.0f;
+
+    Qt3DAnimation::QClock *m_clock;
+    Qt3DLogic::QFrameAction *m_frameAction;
+    bool m_playing = true;
+    qreal m_playbackRate = 1;
+    bool m_loop = true;
+    int m_duration = 0;
+    int m_playheadAnchor = 0; // position at the last seek/pause/rate change or clock update
+    QElapsedTimer m_playheadTimer; // wall time since the anchor, only bridges the clock updates
+
+    bool m_lazyInstantiation = false;
+    bool m_unloadInactive = false;
+    int m_lazyLeadTime = 500;
+    SceneData m_sceneData;
+    struct LazyModel {
+        QByteArray id;
+        const SceneData::Model *model = nullptr;
+        int parent = -1;
+        int subtreeEnd = 0; // descendants are at [index + 1, subtreeEnd)
+        int firstTime = INT_MAX; // shown from, in ms; INT_MAX if never
+        int lastTime = INT_MAX; // hidden for good from, in ms
+        Qt3DCore::QEntity *entity = nullptr;
+        Qt3DAnimation::QClipAnimator *animator = nullptr;
+    };
+    QVector<LazyModel> m_lazyModels; // pre-order
+
+    // Brace-initialized, so no default member initializers (C++11 aggregates);
+    // members left out are null.
+    struct ModelNode {
+        ModelComponents components;
+        Qt3DAnimation::QClipAnimator *animator;
+        Qt3DCore::QEntity *entity; // not for models inside prefabs
+    };
+
+    // Entities of a model with visible keys; prefab models have one per instance.
+    struct VisibilityTrack {
+        QPointer<Qt3DCore::QEntity> entity; // gone when lazily unloaded
+        QByteArray modelId;
+        int key = -1; // last applied
+    };
+
+    struct LodModel {
+        QVector<float> thresholds; // as in SceneData::Model
+        bool screenSize = false;
+        QVector<Qt3DCore::QEntity *> levels;
+        int level = 0;
+    };
+
+    struct PendingModel {
+        QByteArray id;
+        const SceneData::Model *model;
+        Qt3DCore::QEntity *parentEntity;
+        QByteArray prefab;
+    };
+
+    // Everything created for one scene file, all of it under root. With a
+    // playlist the next scene is built into m_nextScene while the current one
+    // plays, with root disabled until it is swapped in. The build helpers take
+    // the scene to build into.
+    struct Scene {
+        Qt3DCore::QEntity *root = nullptr;
+        Qt3DRender::QCamera *camera = nullptr; // the first of cameras
+        QVector<Qt3DRender::QCamera *> cameras; // one view each, in the order of their ids
+        ClusteredLighting *lighting = nullptr;
+        int pointLightCount = 0;
+        QVector<Qt3DAnimation::QClipAnimator *> animators;
+        QHash<QPair<QByteArray, QByteArray>, ModelComponents> prefabComponents; // by prefab and model, shared by all instances
+        QHash<QByteArray, ModelNode> modelNodes; // models that currently have entities
+        QHash<QString, Qt3DRender::QGeometryRenderer *> optimizedMeshes; // shared by all models using the asset
+        QHash<QByteArray, Qt3DAnimation::QAnimationClipData> clips; // prebuilt, see ClipBuilder::buildAll()
+        QHash<QByteArray, QVector<QPair<int, bool> > > visibilityKeys; // only models that have them
+        QVector<VisibilityTrack> visibility;
+        QSet<Qt3DAnimation::QClipAnimator *> suspendedAnimators; // in hidden subtrees
+        QVector<PendingModel> pendingModels; // breadth-first queue, see buildPendingModels()
+        int pendingHead = 0;
+        QHash<Qt3DRender::QLevelOfDetail *, LodModel> lodModels;
+        QVector<int> lodDrawCounts; // per level
+        int replayFrame = -1; // applied frame, -1 to force an update
+    };
+    Scene m_scene;
+    Scene m_nextScene;
+
+    QStringList m_playlist;
+    int m_playlistIndex = -1;
+    QString m_nextFilename; // what m_nextScene and the prefetch watchers are for
+    SceneData m_nextSceneData;
+    QFutureWatcher<SceneData> m_prefetchWatcher;
+    QFutureWatcher<QHash<QByteArray, Qt3DAnimation::QAnimationClipData> > m_clipsWatcher;
+
+    QString m_liveSource;
+    QScopedPointer<LiveControl> m_liveControl;
+    QElapsedTimer m_liveStatsTimer;
+    qint64 m_liveLatencySum = 0; // ns
+    qint64 m_liveLatencyPeak = 0; // ns
+    int m_liveCount = 0;
+    qreal m_liveLatency = 0;
+    qreal m_liveLatencyMax = 0;
+
+    QString m_recordFile;
+    int m_recordInterval = 20;
+    SceneRecorder m_recorder;
+    QByteArrayList m_recordIds;
+    int m_lastRecordedTick = -1;
+    QString m_replayFile;
+    QScopedPointer<SceneRecording> m_replay;
+    QVector<RecordedModelState> m_replayStates;
+
+    bool m_mergeStatic = false;
+    QFutureWatcher<QVector<MergedGeometry> > m_mergeWatcher;
+    QPointer<Qt3DCore::QEntity> m_mergeRoot; // of the scene being merged
+    QPointer<Qt3DCore::QEntity> m_staticOriginals; // shown until the merged geometry is added
+
+    int m_streamWindow = 0;
+    bool m_streaming = false;
+    SceneIndex m_streamIndex;
+    QFutureWatcher<SceneIndex> m_indexWatcher;
+    QFutureWatcher<ClipWindow> m_windowWatcher;
+    ClipWindow m_window; // applied to the animators
+    ClipWindow m_nextWindow; // built ahead, not applied yet
+    int m_requestedWindow = -1;
+
+    Qt3DRender::QRenderSettings *m_renderSettings = nullptr;
+    QVector<SceneActivity::Interval> m_busyIntervals; // sorted
+    bool m_idle = false;
+    QElapsedTimer m_idleTimer;
+    qint64 m_idleTotal = 0;
+    QTimer m_wakeTimer;
+
+    bool m_clusteredLighting = false;
+    QSize m_surfaceSize;
+
+    int m_benchmark = 0;
+    QVector<float> m_frameTimes; // ms
+    float m_benchmarkElapsed = 0; // s
+    double m_lightsPerTileSum = 0;
+    int m_lightsPerTileMax = 0;
+
+    qreal m_targetFrameTime = 0; // ms
+    int m_qualityLevel = 0;
+    float m_qualityElapsed = 0; // s, of the current average
+    float m_qualityFrameTimeSum = 0; // ms
+    int m_qualityFrames = 0;
+    int m_qualityStreak = 0; // averages in a row over (> 0) or well under (< 0) the target
+
+    qreal m_lodBias = 1;
+    QHash<QString, float> m_boundingRadii; // per asset, shared by all scenes
+    bool m_lodDrawCountsDirty = false;
+
+    bool m_optimizeMeshes = false;
+    bool m_quantizeNormals = false;
+
+    int m_buildBudget = 0;
+    int m_builtModels = 0;
+    int m_totalModels = 0;
 };
 
 #endif
@@ -0,0 +1,451 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "scenerecording.h"
+#include <QHash>
+#include <QMatrix4x4>
+#include <QTextStream>
+#include <QtMath>
+#include <algorithm>
+#include <cstring>
+
+static const char Magic[] = "RTSCPLR1";
+static const int MagicLength = 8;
+static const int SyncInterval = 256; // frames
+static const quint32 Absent = 1 << RecordedModelState::ComponentCount;
+
+static inline quint32 floatBits(float f)
+{
+    quint32 u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static inline float bitsFloat(quint32 u)
+{
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static void writeVarint(QByteArray *buf, quint32 v)
+{
+    while (v >= 0x80) {
+        buf->append(char((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    buf->append(char(v));
+}
+
+static bool readVarint(const QByteArray &d, int *pos, quint32 *v)
+{
+    quint32 result = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (*pos >= d.size())
+            return false;
+        const uchar c = uchar(d[(*pos)++]);
+        result |= quint32(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+void RecordedModelState::set(const QVector3D &translation, const QQuaternion &rotation,
+                             const QVector3D &scale, const QColor &color)
+{
+    v[TranslationX] = translation.x();
+    v[TranslationY] = translation.y();
+    v[TranslationZ] = translation.z();
+    v[RotationScalar] = rotation.scalar();
+    v[RotationX] = rotation.x();
+    v[RotationY] = rotation.y();
+    v[RotationZ] = rotation.z();
+    v[ScaleX] = scale.x();
+    v[ScaleY] = scale.y();
+    v[ScaleZ] = scale.z();
+    v[ColorR] = color.redF();
+    v[ColorG] = color.greenF();
+    v[ColorB] = color.blueF();
+    present = true;
+}
+
+bool SceneRecorder::open(const QString &fn, int interval, const QByteArrayList &ids, const QVector<int> &parents)
+{
+    close();
+    m_file.setFileName(fn);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning("Failed to open %s for recording", qPrintable(fn));
+        return false;
+    }
+
+    m_interval = interval;
+    m_lastTick = 0;
+    m_frameCount = 0;
+    m_prev.fill(RecordedModelState(), ids.count());
+
+    m_buf.clear();
+    m_buf.append(Magic, MagicLength);
+    writeVarint(&m_buf, quint32(interval));
+    writeVarint(&m_buf, quint32(ids.count()));
+    for (int i = 0; i < ids.count(); ++i) {
+        writeVarint(&m_buf, quint32(ids[i].size()));
+        m_buf.append(ids[i]);
+        writeVarint(&m_buf, quint32(parents[i] + 1));
+    }
+    m_file.write(m_buf);
+    return true;
+}
+
+void SceneRecorder::close()
+{
+    if (m_file.isOpen())
+        m_file.close();
+}
+
+void SceneRecorder::writeFrame(int tick, const QVector<RecordedModelState> &states)
+{
+    Q_ASSERT(states.count() == m_prev.count() && tick >= m_lastTick);
+    if (m_frameCount % SyncInterval == 0)
+        m_prev.fill(RecordedModelState());
+
+    QByteArray payload;
+    payload.reserve(states.count() * 2);
+    quint32 deltas[RecordedModelState::ComponentCount];
+    for (int i = 0; i < states.count(); ++i) {
+        const RecordedModelState &s(states[i]);
+        RecordedModelState &prev(m_prev[i]);
+        if (!s.present) {
+            writeVarint(&payload, Absent);
+            prev.present = false;
+            continue;
+        }
+        // Unchanged components cost nothing, and since nearby values share their
+        // sign, exponent and high mantissa bits the XOR of a small change is small.
+        quint32 mask = 0;
+        for (int c = 0; c < RecordedModelState::ComponentCount; ++c) {
+            deltas[c] = floatBits(s.v[c]) ^ floatBits(prev.v[c]);
+            if (deltas[c])
+                mask |= 1 << c;
+        }
+        writeVarint(&payload, mask);
+        for (int c = 0; c < RecordedModelState::ComponentCount; ++c) {
+            if (deltas[c])
+                writeVarint(&payload, deltas[c]);
+        }
+        prev = s;
+    }
+
+    m_buf.clear();
+    writeVarint(&m_buf, quint32(tick - m_lastTick));
+    writeVarint(&m_buf, quint32(payload.size()));
+    m_file.write(m_buf);
+    m_file.write(payload);
+    m_lastTick = tick;
+    ++m_frameCount;
+}
+
+bool SceneRecording::load(const QString &fn)
+{
+    QFile f(fn);
+    if (!f.open(QIODevice::ReadOnly)) {
+        qWarning("Failed to open recording %s", qPrintable(fn));
+        return false;
+    }
+    m_data = f.readAll();
+    m_ids.clear();
+    m_parents.clear();
+    m_ticks.clear();
+    m_syncOffsets.clear();
+
+    if (m_data.size() < MagicLength || memcmp(m_data.constData(), Magic, MagicLength)) {
+        qWarning("%s is not a recording", qPrintable(fn));
+        return false;
+    }
+
+    int pos = MagicLength;
+    quint32 interval, count;
+    if (!readVarint(m_data, &pos, &interval) || !readVarint(m_data, &pos, &count) || !interval) {
+        qWarning("Corrupt recording header in %s", qPrintable(fn));
+        return false;
+    }
+    m_interval = int(interval);
+    for (quint32 i = 0; i < count; ++i) {
+        quint32 len, parent;
+        if (!readVarint(m_data, &pos, &len) || pos + int(len) > m_data.size()) {
+            qWarning("Corrupt recording header in %s", qPrintable(fn));
+            return false;
+        }
+        m_ids.append(m_data.mid(pos, int(len)));
+        pos += int(len);
+        if (!readVarint(m_data, &pos, &parent) || int(parent) > m_ids.count() - 1) {
+            qWarning("Corrupt recording header in %s", qPrintable(fn));
+            return false;
+        }
+        m_parents.append(int(parent) - 1);
+    }
+
+    // Index the frames without decoding them.
+    int tick = 0;
+    while (pos < m_data.size()) {
+        const int frameStart = pos;
+        quint32 tickDelta, size;
+        if (!readVarint(m_data, &pos, &tickDelta) || !readVarint(m_data, &pos, &size)
+                || pos + int(size) > m_data.size()) {
+            qWarning("Truncated recording %s, using the first %d frames", qPrintable(fn), m_ticks.count());
+            break;
+        }
+        if (m_ticks.count() % SyncInterval == 0)
+            m_syncOffsets.append(frameStart);
+        tick += int(tickDelta);
+        m_ticks.append(tick);
+        pos += int(size);
+    }
+
+    m_cursorFrame = -1;
+    m_state.fill(RecordedModelState(), m_ids.count());
+    return true;
+}
+
+int SceneRecording::findFrame(int time) const
+{
+    const int tick = time / m_interval;
+    auto it = std::upper_bound(m_ticks.cbegin(), m_ticks.cend(), tick);
+    return int(it - m_ticks.cbegin()) - 1;
+}
+
+bool SceneRecording::decodeNext()
+{
+    int pos = m_cursorOffset;
+    quint32 tickDelta, size;
+    if (!readVarint(m_data, &pos, &tickDelta) || !readVarint(m_data, &pos, &size))
+        return false;
+    const int end = pos + int(size);
+
+    ++m_cursorFrame;
+    if (m_cursorFrame % SyncInterval == 0)
+        m_state.fill(RecordedModelState());
+
+    for (RecordedModelState &s : m_state) {
+        quint32 mask;
+        if (!readVarint(m_data, &pos, &mask) || pos > end)
+            return false;
+        if (mask & Absent) {
+            s.present = false;
+            continue;
+        }
+        s.present = true;
+        for (int c = 0; c < RecordedModelState::ComponentCount; ++c) {
+            if (mask & (1 << c)) {
+                quint32 delta;
+                if (!readVarint(m_data, &pos, &delta))
+                    return false;
+                s.v[c] = bitsFloat(floatBits(s.v[c]) ^ delta);
+            }
+        }
+    }
+
+    m_cursorOffset = end;
+    return pos == end;
+}
+
+bool SceneRecording::readFrame(int frame, QVector<RecordedModelState> *states)
+{
+    if (frame < 0 || frame >= m_ticks.count())
+        return false;
+
+    if (frame < m_cursorFrame || m_cursorFrame < 0 || frame / SyncInterval != m_cursorFrame / SyncInterval) {
+        const int sync = frame / SyncInterval;
+        m_cursorFrame = sync * SyncInterval - 1;
+        m_cursorOffset = m_syncOffsets[sync];
+    }
+    while (m_cursorFrame < frame) {
+        if (!decodeNext()) {
+            qWarning("Corrupt recording frame %d", m_cursorFrame);
+            m_cursorFrame = -1;
+            return false;
+        }
+    }
+
+    *states = m_state;
+    return true;
+}
+
+// Parents come before their children so a single pass composes everything.
+static void worldTransforms(const QVector<int> &parents, const QVector<RecordedModelState> &states,
+                            QVector<QVector3D> *positions, QVector<QQuaternion> *rotations)
+{
+    QVector<QMatrix4x4> world(states.count());
+    positions->resize(states.count());
+    rotations->resize(states.count());
+    for (int i = 0; i < states.count(); ++i) {
+        const RecordedModelState &s(states[i]);
+        QMatrix4x4 m;
+        m.translate(s.translation());
+        m.rotate(s.rotation());
+        m.scale(s.scale());
+        QQuaternion r = s.rotation();
+        if (parents[i] >= 0) {
+            m = world[parents[i]] * m;
+            r = (*rotations)[parents[i]] * r;
+        }
+        world[i] = m;
+        (*positions)[i] = m.column(3).toVector3D();
+        (*rotations)[i] = r;
+    }
+}
+
+int SceneRecording::compare(const QString &fnA, const QString &fnB, float tolerance)
+{
+    SceneRecording a, b;
+    if (!a.load(fnA) || !b.load(fnB))
+        return -1;
+
+    QTextStream out(stdout);
+    QHash<QByteArray, int> indexInB;
+    for (int i = 0; i < b.ids().count(); ++i)
+        indexInB.insert(b.ids()[i], i);
+
+    struct Deviation {
+        float position = 0;
+        float rotation = 0; // degrees
+        float scale = 0;
+        float color = 0;
+        int worstTime = -1;
+        int presenceMismatches = 0;
+        float worst() const { return qMax(qMax(position, rotation), qMax(scale, color)); }
+    };
+    QVector<Deviation> dev(a.ids().count());
+
+    int failed = 0;
+    for (int i = 0; i < a.ids().count(); ++i) {
+        if (!indexInB.contains(a.ids()[i])) {
+            out << "  " << a.ids()[i] << ": missing from " << fnB << "\n";
+            ++failed;
+        }
+    }
+    for (const QByteArray &id : b.ids()) {
+        if (!a.ids().contains(id)) {
+            out << "  " << id << ": missing from " << fnA << "\n";
+            ++failed;
+        }
+    }
+
+    // Walk both recordings in time order and compare the frames they have in common.
+    QVector<RecordedModelState> sa, sb;
+    QVector<QVector3D> posA, posB;
+    QVector<QQuaternion> rotA, rotB;
+    int fa = 0, fb = 0, matched = 0;
+    while (fa < a.frameCount() && fb < b.frameCount()) {
+        const int ta = a.frameTime(fa);
+        const int tb = b.frameTime(fb);
+        if (ta < tb) {
+            ++fa;
+            continue;
+        }
+        if (tb < ta) {
+            ++fb;
+            continue;
+        }
+        if (!a.readFrame(fa++, &sa) || !b.readFrame(fb++, &sb))
+            return -1;
+        ++matched;
+        worldTransforms(a.parents(), sa, &posA, &rotA);
+        worldTransforms(b.parents(), sb, &posB, &rotB);
+        for (int i = 0; i < sa.count(); ++i) {
+            const int j = indexInB.value(a.ids()[i], -1);
+            if (j < 0)
+                continue;
+            Deviation &d(dev[i]);
+            if (sa[i].present != sb[j].present) {
+                ++d.presenceMismatches;
+                continue;
+            }
+            if (!sa[i].present)
+                continue;
+            const float before = d.worst();
+            d.position = qMax(d.position, (posA[i] - posB[j]).length());
+            const float dot = qMin(1.0f, qAbs(QQuaternion::dotProduct(rotA[i].normalized(), rotB[j].normalized())));
+            d.rotation = qMax(d.rotation, float(qRadiansToDegrees(2 * qAcos(dot))));
+            for (int c = RecordedModelState::ScaleX; c <= RecordedModelState::ScaleZ; ++c)
+                d.scale = qMax(d.scale, qAbs(sa[i].v[c] - sb[j].v[c]));
+            for (int c = RecordedModelState::ColorR; c <= RecordedModelState::ColorB; ++c)
+                d.color = qMax(d.color, qAbs(sa[i].v[c] - sb[j].v[c]));
+            if (d.worst() > before)
+                d.worstTime = ta;
+        }
+    }
+
+    out << matched << " common frames (" << a.frameCount() << " in " << fnA << ", "
+        << b.frameCount() << " in " << fnB << ")\n";
+    if (!matched)
+        return -1;
+
+    out << "model: max position / rotation (deg) / scale / color deviation, at ms\n";
+    for (int i = 0; i < a.ids().count(); ++i) {
+        if (!indexInB.contains(a.ids()[i]))
+            continue;
+        const Deviation &d(dev[i]);
+        const bool bad = d.worst() > tolerance || d.presenceMismatches;
+        if (bad)
+            ++failed;
+        out << (bad ? "! " : "  ") << a.ids()[i] << ": " << d.position << " / " << d.rotation
+            << " / " << d.scale << " / " << d.color;
+        if (d.worstTime >= 0)
+            out << " @" << d.worstTime;
+        if (d.presenceMismatches)
+            out << ", present in only one recording in " << d.presenceMismatches << " frames";
+        out << "\n";
+    }
+    out << failed << " models exceed tolerance " << tolerance << "\n";
+    return failed;
+}
@@ -0,0 +1,147 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef SCENERECORDING_H
+#define SCENERECORDING_H
+
+#include <QByteArrayList>
+#include <QFile>
+#include <QVector>
+#include <QVector3D>
+#include <QQuaternion>
+#include <QColor>
+
+// Evaluated state of one model at one recorded frame.
+struct RecordedModelState
+{
+    enum Component {
+        TranslationX, TranslationY, TranslationZ,
+        RotationScalar, RotationX, RotationY, RotationZ,
+        ScaleX, ScaleY, ScaleZ,
+        ColorR, ColorG, ColorB,
+        ComponentCount
+    };
+    float v[ComponentCount] = { };
+    bool present = false; // false when the model had no entity at the time
+
+    QVector3D translation() const { return QVector3D(v[TranslationX], v[TranslationY], v[TranslationZ]); }
+    QQuaternion rotation() const { return QQuaternion(v[RotationScalar], v[RotationX], v[RotationY], v[RotationZ]); }
+    QVector3D scale() const { return QVector3D(v[ScaleX], v[ScaleY], v[ScaleZ]); }
+    QColor color() const { return QColor::fromRgbF(v[ColorR], v[ColorG], v[ColorB]); }
+    void set(const QVector3D &translation, const QQuaternion &rotation, const QVector3D &scale, const QColor &color);
+};
+
+// Binary layout, all integers are unsigned LEB128 varints:
+//   "RTSCPLR1" interval modelCount { idLength id parentIndex+1 }*
+//   { tickDelta payloadSize payload }*
+// A payload has, for each model, a mask of the changed components (or Absent)
+// followed by the float bits of each changed component XORed with its value
+// in the previous frame. Every SyncInterval-th frame is encoded against zero
+// so that seeking does not need to decode from the start.
+class SceneRecorder
+{
+public:
+    // Models are identified by id; parents must come before their children.
+    bool open(const QString &fn, int interval, const QByteArrayList &ids, const QVector<int> &parents);
+    bool isOpen() const { return m_file.isOpen(); }
+    void close();
+
+    int interval() const { return m_interval; }
+    int modelCount() const { return m_prev.count(); }
+    int frameCount() const { return m_frameCount; }
+
+    // tick is the time in intervals and must not go backwards.
+    void writeFrame(int tick, const QVector<RecordedModelState> &states);
+
+private:
+    QFile m_file;
+    int m_interval = 0;
+    int m_lastTick = 0;
+    int m_frameCount = 0;
+    QVector<RecordedModelState> m_prev;
+    QByteArray m_buf;
+};
+
+class SceneRecording
+{
+public:
+    bool load(const QString &fn);
+
+    int interval() const { return m_interval; }
+    const QByteArrayList &ids() const { return m_ids; }
+    const QVector<int> &parents() const { return m_parents; }
+    int frameCount() const { return m_ticks.count(); }
+    int frameTime(int frame) const { return m_ticks[frame] * m_interval; }
+    int frameTick(int frame) const { return m_ticks[frame]; }
+    int findFrame(int time) const; // last frame at or before time, -1 if none
+
+    // Sequential reads are cheap; anything else restarts from the nearest sync frame.
+    bool readFrame(int frame, QVector<RecordedModelState> *states);
+
+    // Prints per-model deviations of world transforms and colors between two
+    // recordings, over the frames recorded at the same time. Returns the number
+    // of models exceeding the tolerance, or -1 on error.
+    static int compare(const QString &fnA, const QString &fnB, float tolerance);
+
+private:
+    bool decodeNext();
+
+    QByteArray m_data;
+    int m_interval = 0;
+    QByteArrayList m_ids;
+    QVector<int> m_parents;
+    QVector<int> m_ticks;
+    QVector<int> m_syncOffsets; // payload offset of every SyncInterval-th frame
+    int m_cursorFrame = -1; // m_state holds this frame
+    int m_cursorOffset = 0; // start of the next frame
+    QVector<RecordedModelState> m_state;
+};
+
+#endif
@@ -0,0 +1,176 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "scenetrace.h"
+
+#ifdef RTSCPL_TRACE
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+#include <QCoreApplication>
+
+SceneTracer *SceneTracer::instance()
+{
+    static SceneTracer tracer;
+    return &tracer;
+}
+
+SceneTracer::SceneTracer()
+{
+    m_timer.start();
+}
+
+int SceneTracer::currentThreadId()
+{
+    static thread_local int tid = -1;
+    if (tid < 0) {
+        QByteArray name = QThread::currentThread()->objectName().toUtf8();
+        if (name.isEmpty()) {
+            if (QCoreApplication::instance() && QThread::currentThread() == QCoreApplication::instance()->thread())
+                name = QByteArrayLiteral("main");
+            else
+                name = QByteArrayLiteral("worker");
+        }
+        QMutexLocker lock(&m_lock);
+        tid = m_threadNames.count();
+        m_threadNames.append(name);
+    }
+    return tid;
+}
+
+int SceneTracer::virtualThreadId(const QByteArray &name)
+{
+    QMutexLocker lock(&m_lock);
+    int tid = m_threadNames.indexOf(name);
+    if (tid < 0) {
+        tid = m_threadNames.count();
+        m_threadNames.append(name);
+    }
+    return tid;
+}
+
+SceneTracer::ThreadBuffer *SceneTracer::threadBuffer()
+{
+    static thread_local ThreadBuffer *buffer = nullptr;
+    if (!buffer) {
+        buffer = new ThreadBuffer;
+        QMutexLocker lock(&m_lock);
+        m_buffers.append(buffer);
+    }
+    return buffer;
+}
+
+void SceneTracer::addEvent(const QByteArray &name, qint64 startUs, qint64 durUs, int tid,
+                           const char *argName, const QByteArray &arg)
+{
+    ThreadBuffer *buffer = threadBuffer();
+    QMutexLocker lock(&buffer->lock);
+    buffer->events.append({ name, argName, arg, startUs, durUs, tid });
+}
+
+bool SceneTracer::write(const QString &fn)
+{
+    QMutexLocker lock(&m_lock);
+
+    QJsonArray events;
+    const qint64 pid = QCoreApplication::applicationPid();
+
+    for (int tid = 0; tid < m_threadNames.count(); ++tid) {
+        QJsonObject e;
+        e[QStringLiteral("ph")] = QStringLiteral("M");
+        e[QStringLiteral("name")] = QStringLiteral("thread_name");
+        e[QStringLiteral("pid")] = pid;
+        e[QStringLiteral("tid")] = tid;
+        QJsonObject args;
+        args[QStringLiteral("name")] = QString::fromUtf8(m_threadNames[tid]);
+        e[QStringLiteral("args")] = args;
+        events.append(e);
+    }
+
+    int eventCount = 0;
+    for (ThreadBuffer *buffer : qAsConst(m_buffers)) {
+        QMutexLocker bufferLock(&buffer->lock);
+        eventCount += buffer->events.count();
+        for (const Event &ev : qAsConst(buffer->events)) {
+            QJsonObject e;
+            e[QStringLiteral("ph")] = QStringLiteral("X");
+            e[QStringLiteral("name")] = QString::fromUtf8(ev.name);
+            e[QStringLiteral("cat")] = QStringLiteral("rtscpl");
+            e[QStringLiteral("ts")] = ev.ts;
+            e[QStringLiteral("dur")] = ev.dur;
+            e[QStringLiteral("pid")] = pid;
+            e[QStringLiteral("tid")] = ev.tid;
+            if (ev.argName && !ev.arg.isEmpty()) {
+                QJsonObject args;
+                args[QString::fromLatin1(ev.argName)] = QString::fromUtf8(ev.arg);
+                e[QStringLiteral("args")] = args;
+            }
+            events.append(e);
+        }
+    }
+
+    QJsonObject root;
+    root[QStringLiteral("traceEvents")] = events;
+    root[QStringLiteral("displayTimeUnit")] = QStringLiteral("ms");
+
+    QFile f(fn);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning("Failed to open %s", qPrintable(fn));
+        return false;
+    }
+    f.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    qDebug("Wrote %d trace events to %s", eventCount, qPrintable(fn));
+    return true;
+}
+
+#endif
@@ -0,0 +1,139 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef SCENETRACE_H
+#define SCENETRACE_H
+
+// Scoped trace instrumentation producing Chrome trace-event JSON (load the
+// output in chrome://tracing or ui.perfetto.dev). Only compiled in when
+// building with CONFIG+=trace; otherwise the macros expand to nothing.
+
+#ifdef RTSCPL_TRACE
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QVector>
+
+class SceneTracer
+{
+public:
+    static SceneTracer *instance();
+
+    qint64 now() const { return m_timer.nsecsElapsed() / 1000; }
+    int currentThreadId();
+    int virtualThreadId(const QByteArray &name);
+
+    // argName is a literal naming arg in the event's args, e.g. "file" or "model".
+    void addEvent(const QByteArray &name, qint64 startUs, qint64 durUs, int tid,
+                  const char *argName = nullptr, const QByteArray &arg = QByteArray());
+    bool write(const QString &fn);
+
+private:
+    SceneTracer();
+
+    struct Event {
+        QByteArray name;
+        const char *argName;
+        QByteArray arg;
+        qint64 ts;
+        qint64 dur;
+        int tid;
+    };
+
+    // Each thread appends to a buffer of its own, so the loader threads do not
+    // contend for one lock per event. The buffer lock is only ever taken by
+    // someone else in write(). Buffers outlive their threads.
+    struct ThreadBuffer {
+        QMutex lock;
+        QVector<Event> events;
+    };
+    ThreadBuffer *threadBuffer();
+
+    QElapsedTimer m_timer;
+    QMutex m_lock; // guards m_buffers and m_threadNames
+    QVector<ThreadBuffer *> m_buffers;
+    QVector<QByteArray> m_threadNames;
+};
+
+class SceneTraceScope
+{
+public:
+    SceneTraceScope(const char *name, const char *argName = nullptr, const QByteArray &arg = QByteArray())
+        : m_name(name), m_argName(argName), m_arg(arg), m_start(SceneTracer::instance()->now()) { }
+    ~SceneTraceScope() {
+        SceneTracer *t = SceneTracer::instance();
+        t->addEvent(m_name, m_start, t->now() - m_start, t->currentThreadId(), m_argName, m_arg);
+    }
+
+private:
+    const char *m_name;
+    const char *m_argName;
+    QByteArray m_arg;
+    qint64 m_start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) SceneTraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, argName, arg) SceneTraceScope TRACE_CONCAT(traceScope, __LINE__)(name, argName, arg)
+#define TRACE_WRITE() SceneTracer::instance()->write(qEnvironmentVariableIsSet("RTSCPL_TRACE_FILE") \
+                                                    ? qEnvironmentVariable("RTSCPL_TRACE_FILE") \
+                                                    : QStringLiteral("rtscpl_trace.json"))
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name, argName, arg)
+#define TRACE_WRITE()
+
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+#version 150 core
+
+// See ClusteredLighting for the layout of lightGrid.
+
+in vec3 worldPosition;
+in vec3 worldNormal;
+
+out vec4 fragColor;
+
+uniform sampler2D lightGrid;
+uniform int tileSize;
+uniform ivec2 viewOrigin; // of the viewport, in pixels
+uniform int tilesX;
+uniform int tileBase;
+uniform int indexBase;
+
+uniform vec4 kd;
+uniform vec4 ambient;
+
+const int MAX_DIR_LIGHTS = 4;
+uniform vec3 dirLightDirections[MAX_DIR_LIGHTS];
+uniform int dirLightCount;
+
+vec4 texel(int i)
+{
+    return texelFetch(lightGrid, ivec2(i % 1024, i / 1024), 0);
+}
+
+void main()
+{
+    vec3 n = normalize(worldNormal);
+    vec3 light = ambient.rgb;
+
+    for (int i = 0; i < dirLightCount; ++i)
+        light += vec3(max(dot(n, -dirLightDirections[i]), 0.0));
+
+    ivec2 tile = max(ivec2(gl_FragCoord.xy) - viewOrigin, ivec2(0)) / tileSize;
+    vec4 header = texel(tileBase + tile.y * tilesX + tile.x);
+    int offset = int(header.x);
+    int count = int(header.y);
+    for (int i = 0; i < count; ++i) {
+        int idx = indexBase * 4 + offset + i;
+        int lightIndex = int(texel(idx / 4)[idx % 4]);
+        vec4 posRange = texel(lightIndex * 2);
+        vec3 toLight = posRange.xyz - worldPosition;
+        float d = length(toLight);
+        if (d >= posRange.w)
+            continue;
+        float att = 1.0 - d / posRange.w;
+        light += texel(lightIndex * 2 + 1).rgb * max(dot(n, toLight / d), 0.0) * att * att;
+    }
+
+    fragColor = vec4(kd.rgb * light, kd.a);
+}
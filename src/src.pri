@@ -1,16 +1,41 @@
-QT += quick 3dcore 3drender 3dquick 3danimation 3dquickextras concurrent
+QT += quick 3dcore 3drender 3dquick 3danimation 3dquickextras 3dlogic concurrent network
+
+# qmake CONFIG+=trace to enable Chrome trace-event output (written to $RTSCPL_TRACE_FILE, or rtscpl_trace.json)
+trace: DEFINES += RTSCPL_TRACE
 
 SOURCES += \
+    src/clipbuilder.cpp \
+    src/clusteredlighting.cpp \
+    src/compactscenedata.cpp \
+    src/livecontrol.cpp \
     src/main.cpp \
+    src/meshloader.cpp \
+    src/meshoptimizer.cpp \
+    src/multiviewrenderer.cpp \
+    src/scenecache.cpp \
     src/sceneplayer.cpp \
+    src/scenerecording.cpp \
+    src/scenetrace.cpp \
     src/twospaceparser.cpp
 
 HEADERS += \
+    src/clipbuilder.h \
+    src/clusteredlighting.h \
+    src/compactscenedata.h \
+    src/livecontrol.h \
+    src/meshloader.h \
+    src/meshoptimizer.h \
+    src/multiviewrenderer.h \
+    src/scenecache.h \
     src/sceneplayer.h \
+    src/scenerecording.h \
+    src/scenetrace.h \
     src/twospaceparser.h
 
 OTHER_FILES += \
-    src/main.qml
+    src/main.qml \
+    src/shaders/clusteredlight.frag \
+    src/shaders/clusteredlight.vert
 
 RESOURCES += \
     src/rtscplq3t.qrc
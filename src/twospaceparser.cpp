@@ -49,14 +49,21 @@
 ****************************************************************************/
 
 #include "twospaceparser.h"
-#include <QtConcurrentRun>
+#include "compactscenedata.h"
+#include "scenecache.h"
+#include "scenetrace.h"
 #include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QtConcurrentMap>
 #include <QStack>
+#include <QElapsedTimer>
+#include <algorithm>
 
 QDebug operator<<(QDebug dbg, const SceneData::Model &model)
 {
     QDebugStateSaver saver(dbg);
-    dbg.space() << "Model(" << model.filename << model.childModels << ")";
+    dbg.space() << "Model(" << model.filename << model.lodFilenames << model.prefab << model.instanceCount() << model.childModels << ")";
     return dbg;
 }
 
@@ -84,7 +91,7 @@ QDebug operator<<(QDebug dbg, const SceneData::LightChange &ch)
 QDebug operator<<(QDebug dbg, const SceneData::ModelChange &ch)
 {
     QDebugStateSaver saver(dbg);
-    dbg.space() << "ModelChange(" << ch.change << ch.translation << ch.rotation << ch.scale << ch.color << ")";
+    dbg.space() << "ModelChange(" << ch.change << ch.translation << ch.rotation << ch.scale << ch.color << ch.visible << ch.easing.keys() << ")";
     return dbg;
 }
 
@@ -92,253 +99,857 @@ void SceneParser::load(const QString &fn)
 {
     reset();
     m_maybeRunning = true;
-    m_future = QtConcurrent::run([fn]() {
-        SceneData scene;
-        QFile f(fn);
-        if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
-            qWarning("Failed to open %s", qPrintable(fn));
-            return scene;
+    m_future = SceneCache::instance()->load(fn);
+}
+
+// model <id> <filename> [lod|lodpx <threshold> <filename> ...]
+// instance <id> <prefab>
+// array <id> <prefab> <count> <dx> <dy> <dz>
+// grid <id> <prefab> <nx> <ny> <nz> <dx> <dy> <dz>
+static bool parseModelEntry(const QByteArrayList &c, SceneData::Model *mdl)
+{
+    bool ok = true;
+    auto toInt = [&ok](const QByteArray &s) {
+        bool b = false;
+        const int v = s.toInt(&b);
+        ok = ok && b && v > 0;
+        return v;
+    };
+    auto toFloat = [&ok](const QByteArray &s) {
+        bool b = false;
+        const float v = s.toFloat(&b);
+        ok = ok && b;
+        return v;
+    };
+
+    if (c[0] == "model" && c.count() == 3) {
+        mdl->filename = QString::fromUtf8(c[2]);
+    } else if (c[0] == "model" && c.count() >= 6 && c.count() % 2 == 0 && (c[3] == "lod" || c[3] == "lodpx")) {
+        mdl->filename = QString::fromUtf8(c[2]);
+        mdl->lodScreenSize = c[3] == "lodpx";
+        for (int i = 4; i < c.count(); i += 2) {
+            const float threshold = toFloat(c[i]);
+            // Distances grow and screen sizes shrink from one level to the next.
+            if (threshold <= 0 || (!mdl->lodThresholds.isEmpty()
+                                   && (mdl->lodScreenSize ? threshold >= mdl->lodThresholds.last()
+                                                          : threshold <= mdl->lodThresholds.last())))
+                return false;
+            mdl->lodThresholds.append(threshold);
+            mdl->lodFilenames.append(QString::fromUtf8(c[i + 1]));
         }
+    } else if (c[0] == "instance" && c.count() == 3) {
+        mdl->prefab = c[2];
+    } else if (c[0] == "array" && c.count() == 7) {
+        mdl->prefab = c[2];
+        mdl->instances[0] = toInt(c[3]);
+        mdl->instanceSpacing = QVector3D(toFloat(c[4]), toFloat(c[5]), toFloat(c[6]));
+    } else if (c[0] == "grid" && c.count() == 9) {
+        mdl->prefab = c[2];
+        for (int i = 0; i < 3; ++i)
+            mdl->instances[i] = toInt(c[3 + i]);
+        mdl->instanceSpacing = QVector3D(toFloat(c[6]), toFloat(c[7]), toFloat(c[8]));
+    } else {
+        return false;
+    }
+    return ok;
+}
 
-        int lineIdx = 0;
-        bool inScene = false, inFrames = false;
-        int lastModelSpc = 2;
-        QByteArray lastModelId;
-        QStack<QByteArray> parentModelIdStack;
-        SceneData::Frame *currentFrame = nullptr;
-
-        auto parseModel = [&](const QByteArrayList &c, int spc) {
-            SceneData::Model mdl;
-            mdl.filename = QString::fromUtf8(c[2]);
-            if (spc > lastModelSpc)
-                parentModelIdStack.push(lastModelId);
-            else if (spc < lastModelSpc) {
-                int s = lastModelSpc;
-                while (spc < s) {
-                    parentModelIdStack.pop();
-                    s -= 2;
-                }
+// Optional easing following a property value: one of the presets or
+// 'bezier <x1> <y1> <x2> <y2>' with the handles relative to the segment.
+static bool parseEasing(const QByteArrayList &c, int *i, SceneData::Easing *e, QByteArray *error)
+{
+    if (*i + 1 >= c.count())
+        return true;
+
+    const QByteArray &s(c[*i + 1]);
+    if (s == "linear") {
+        *e = SceneData::Easing(0, 0, 1, 1);
+    } else if (s == "ease") {
+        *e = SceneData::Easing(0.25f, 0.1f, 0.25f, 1);
+    } else if (s == "ease-in") {
+        *e = SceneData::Easing(0.42f, 0, 1, 1);
+    } else if (s == "ease-out") {
+        *e = SceneData::Easing(0, 0, 0.58f, 1);
+    } else if (s == "ease-in-out") {
+        *e = SceneData::Easing(0.42f, 0, 0.58f, 1);
+    } else if (s == "bezier") {
+        if (*i + 5 >= c.count()) {
+            *error = QByteArrayLiteral("Incomplete bezier easing");
+            return false;
+        }
+        float v[4];
+        for (int j = 0; j < 4; ++j) {
+            bool ok = false;
+            v[j] = c[*i + 2 + j].toFloat(&ok);
+            if (!ok) {
+                *error = QByteArrayLiteral("Invalid bezier handle '") + c[*i + 2 + j] + '\'';
+                return false;
             }
-            lastModelSpc = spc;
-            lastModelId = c[1];
-            return mdl;
-        };
+        }
+        // The curve must stay a function of time.
+        if (v[0] < 0 || v[0] > 1 || v[2] < 0 || v[2] > 1) {
+            *error = QByteArrayLiteral("Bezier handle x values must be within [0, 1]");
+            return false;
+        }
+        *e = SceneData::Easing(v[0], v[1], v[2], v[3]);
+        *i += 4;
+    } else {
+        return true;
+    }
 
-        while (!f.atEnd()) {
-            ++lineIdx;
-            QByteArray line = f.readLine();
-            int spc = 0;
-            while (spc < line.count() && line[spc] == ' ')
-                ++spc;
-            if (spc % 2) {
-                qWarning("%s: Malformed line %d, invalid space count %d", qPrintable(fn), lineIdx, spc);
-                return scene;
+    e->valid = true;
+    *i += 1;
+    return true;
+}
+
+bool SceneParser::parseModelChange(const QByteArrayList &c, SceneData::ModelChange *ch, QByteArray *error)
+{
+    static const struct {
+        const char *name;
+        int which;
+    } props[] = {
+        { "trans.x", SceneData::ModelChange::TranslationX },
+        { "trans.y", SceneData::ModelChange::TranslationY },
+        { "trans.z", SceneData::ModelChange::TranslationZ },
+        { "rot.x", SceneData::ModelChange::RotationX },
+        { "rot.y", SceneData::ModelChange::RotationY },
+        { "rot.z", SceneData::ModelChange::RotationZ },
+        { "scale.x", SceneData::ModelChange::ScaleX },
+        { "scale.y", SceneData::ModelChange::ScaleY },
+        { "scale.z", SceneData::ModelChange::ScaleZ },
+        { "color", SceneData::ModelChange::Color },
+        { "visible", SceneData::ModelChange::Visible }
+    };
+
+    for (int i = 1; i < c.count(); ++i) {
+        int which = 0;
+        for (const auto &prop : props) {
+            if (c[i] == prop.name) {
+                which = prop.which;
+                break;
             }
+        }
+        if (!which) {
+            *error = QByteArrayLiteral("Unknown model property reference '") + c[i] + '\'';
+            return false;
+        }
+        if (i + 1 >= c.count()) {
+            *error = QByteArrayLiteral("Missing value for '") + c[i] + '\'';
+            return false;
+        }
+
+        ++i;
+        ch->change |= which;
+        switch (which) {
+        case SceneData::ModelChange::TranslationX: ch->translation.setX(c[i].toFloat()); break;
+        case SceneData::ModelChange::TranslationY: ch->translation.setY(c[i].toFloat()); break;
+        case SceneData::ModelChange::TranslationZ: ch->translation.setZ(c[i].toFloat()); break;
+        case SceneData::ModelChange::RotationX: ch->rotation.setX(c[i].toFloat()); break;
+        case SceneData::ModelChange::RotationY: ch->rotation.setY(c[i].toFloat()); break;
+        case SceneData::ModelChange::RotationZ: ch->rotation.setZ(c[i].toFloat()); break;
+        case SceneData::ModelChange::ScaleX: ch->scale.setX(c[i].toFloat()); break;
+        case SceneData::ModelChange::ScaleY: ch->scale.setY(c[i].toFloat()); break;
+        case SceneData::ModelChange::ScaleZ: ch->scale.setZ(c[i].toFloat()); break;
+        case SceneData::ModelChange::Color: ch->color = QColor(QString::fromUtf8(c[i])); break;
+        case SceneData::ModelChange::Visible:
+            if (c[i] != "0" && c[i] != "1") {
+                *error = QByteArrayLiteral("Invalid value for 'visible', expected 0 or 1");
+                return false;
+            }
+            ch->visible = c[i] == "1";
+            break;
+        default: break;
+        }
 
-            if (line.mid(spc).startsWith("//"))
-                continue;
+        SceneData::Easing e;
+        if (!parseEasing(c, &i, &e, error))
+            return false;
+        if (e.valid && which == SceneData::ModelChange::Visible) {
+            *error = QByteArrayLiteral("'visible' cannot be eased");
+            return false;
+        }
+        if (e.valid)
+            ch->easing.insert(which, e);
+    }
 
-            line = line.trimmed();
-            if (line.isEmpty())
-                continue;
+    return true;
+}
 
-            const QByteArrayList c = line.split(' ');
+static void indexModelChange(SceneIndex *index, int t, const QByteArray &id, const SceneData::ModelChange &ch)
+{
+    SceneIndex::ModelKeys &keys(index->modelKeys[id]);
+    if (ch.change & SceneData::ModelChange::Visible)
+        keys.visibility.append(qMakePair(t, ch.visible));
+    if (t == 0)
+        return; // the initial state, not an animation
+    keys.changes |= ch.change;
+    for (int channel = 0; channel < SceneIndex::ChannelCount; ++channel) {
+        if (ch.change & SceneIndex::channelMask(channel))
+            keys.channelTimes[channel].append(t);
+    }
+}
 
-            if (spc == 0) {
-                if (c[0] == "scene" && c.count() == 1) {
-                    inScene = true;
-                    inFrames = false;
-                } else if (c[0] == "frames" && c.count() == 2) {
-                    inFrames = true;
-                    inScene = false;
-                    bool ok = false;
-                    scene.totalTime = c[1].toInt(&ok);
-                    if (!ok) {
-                        qWarning("%s: Malformed total time at line %d", qPrintable(fn), lineIdx);
-                        return scene;
+// A camera, light or model line inside a keyframe.
+static bool parseFrameLine(const QString &fn, int lineIdx, const QByteArrayList &c,
+                           SceneData *scene, SceneData::Frame *frame)
+{
+    if (scene->cameras.contains(c[0])) {
+        SceneData::CameraChange ch;
+        for (int i = 1; i < c.count(); ++i) {
+            QByteArrayList propRef = c[i].split('.');
+            if (propRef.count() == 2) {
+                if (propRef[0] == "pos") {
+                    ch.change |= SceneData::CameraChange::Position;
+                    if (propRef[1] == "x") {
+                        ch.position.setX(c[i+1].toFloat());
+                        ++i;
+                    } else if (propRef[1] == "y") {
+                        ch.position.setY(c[i+1].toFloat());
+                        ++i;
+                    } else if (propRef[1] == "z") {
+                        ch.position.setZ(c[i+1].toFloat());
+                        ++i;
+                    }
+                } else if (propRef[0] == "view") {
+                    ch.change |= SceneData::CameraChange::ViewCenter;
+                    if (propRef[1] == "x") {
+                        ch.viewCenter.setX(c[i+1].toFloat());
+                        ++i;
+                    } else if (propRef[1] == "y") {
+                        ch.viewCenter.setY(c[i+1].toFloat());
+                        ++i;
+                    } else if (propRef[1] == "z") {
+                        ch.viewCenter.setZ(c[i+1].toFloat());
+                        ++i;
                     }
                 } else {
-                    qWarning("%s: Malformed line %d", qPrintable(fn), lineIdx);
+                    qWarning("%s: Unknown camera property reference '%s' at line %d", qPrintable(fn), propRef[0].constData(), lineIdx);
+                }
+            }
+        }
+        frame->cameraChanges.insert(c[0], ch);
+    } else if (scene->lights.contains(c[0])) {
+        SceneData::LightChange ch;
+        for (int i = 1; i < c.count(); ++i) {
+            QByteArrayList propRef = c[i].split('.');
+            if (propRef.count() == 2) {
+                if (propRef[0] == "pos") {
+                    ch.change |= SceneData::LightChange::Position;
+                    if (propRef[1] == "x") {
+                        ch.position.setX(c[i+1].toFloat());
+                        ++i;
+                    } else if (propRef[1] == "y") {
+                        ch.position.setY(c[i+1].toFloat());
+                        ++i;
+                    } else if (propRef[1] == "z") {
+                        ch.position.setZ(c[i+1].toFloat());
+                        ++i;
+                    }
+                } else {
+                    qWarning("%s: Unknown light property reference '%s' at line %d", qPrintable(fn), propRef[0].constData(), lineIdx);
+                }
+            }
+        }
+        frame->lightChanges.insert(c[0], ch);
+    } else if (scene->model(c[0])) {
+        SceneData::ModelChange ch;
+        QByteArray error;
+        if (!parseModelChange(c, &ch, &error)) {
+            qWarning("%s: %s at line %d", qPrintable(fn), error.constData(), lineIdx);
+            return false;
+        }
+        frame->modelChanges.insert(c[0], ch);
+    }
+    return true;
+}
+
+// Reads fn one line at a time, calling func with each non-empty, non-comment
+// line until it returns false. Only the current line is held in memory.
+static bool forEachLine(const QString &fn, const std::function<bool(const SceneSource::Line &)> &func)
+{
+    QFile f(fn);
+    // Keyframe offsets must be usable with seek() so no newline conversion.
+    // Lines are trimmed anyway.
+    if (!f.open(QIODevice::ReadOnly)) {
+        qWarning("Failed to open %s", qPrintable(fn));
+        return false;
+    }
+
+    int lineIdx = 0;
+    while (!f.atEnd()) {
+        ++lineIdx;
+        const qint64 offset = f.pos();
+        const QByteArray raw = f.readLine();
+
+        int spc = 0;
+        while (spc < raw.size() && raw[spc] == ' ')
+            ++spc;
+        if (spc % 2) {
+            qWarning("%s: Malformed line %d, invalid space count %d", qPrintable(fn), lineIdx, spc);
+            return false;
+        }
+
+        const QByteArray line = raw.mid(spc).trimmed();
+        if (line.isEmpty() || line.startsWith("//"))
+            continue;
+
+        if (!func({ lineIdx, spc, line.split(' '), offset }))
+            return false;
+    }
+    return true;
+}
+
+SceneSource SceneParser::tokenize(const QString &fn)
+{
+    TRACE_SCOPE_ARG("SceneParser::tokenize", "file", fn.toUtf8());
+    SceneSource src;
+    src.filename = fn;
+    src.valid = forEachLine(fn, [&src](const SceneSource::Line &l) {
+        src.lines.append(l);
+        return true;
+    });
+    return src;
+}
+
+static bool isInclude(const SceneSource::Line &l)
+{
+    return l.spc == 2 && l.c[0] == "include";
+}
+
+static SceneSource cachedSource(const QString &fn)
+{
+    return SceneCache::instance()->source(fn);
+}
+
+// Reads every keyframe back from the compact form and compares it with the
+// parsed one, so that the memory comparison is known to be for the same data.
+static int compactMismatches(const SceneData &sd, const CompactSceneData &compact)
+{
+    int mismatches = 0;
+    for (int fi = 0; fi < compact.frameCount(); ++fi) {
+        const SceneData::Frame &f(sd.frames[fi]);
+        if (compact.frameTime(fi) != f.t)
+            ++mismatches;
+        int count = 0;
+        compact.forEachChange(fi, [&](const CompactSceneData::Change &c) {
+            ++count;
+            if (c.entity < 0) {
+                ++mismatches;
+                return;
+            }
+            const QByteArray id = compact.entityId(c.entity);
+            if (compact.entityIndex(compact.entityKind(c.entity), id) != c.entity)
+                ++mismatches;
+            switch (compact.entityKind(c.entity)) {
+            case CompactSceneData::Camera: {
+                const SceneData::CameraChange ch = compact.cameraChange(c);
+                const SceneData::CameraChange orig = f.cameraChanges.value(id);
+                if (ch.change != orig.change || ch.position != orig.position || ch.viewCenter != orig.viewCenter)
+                    ++mismatches;
+                break;
+            }
+            case CompactSceneData::Light: {
+                const SceneData::LightChange ch = compact.lightChange(c);
+                const SceneData::LightChange orig = f.lightChanges.value(id);
+                if (ch.change != orig.change || ch.position != orig.position)
+                    ++mismatches;
+                break;
+            }
+            case CompactSceneData::Model: {
+                const SceneData::ModelChange ch = compact.modelChange(c);
+                const SceneData::ModelChange orig = f.modelChanges.value(id);
+                bool same = ch.change == orig.change && ch.easing.count() == orig.easing.count();
+                const QVector3D a[3] = { ch.translation, ch.rotation, ch.scale };
+                const QVector3D b[3] = { orig.translation, orig.rotation, orig.scale };
+                for (int bit = 0; bit < 9; ++bit) {
+                    if ((ch.change & (1 << bit)) && a[bit / 3][bit % 3] != b[bit / 3][bit % 3])
+                        same = false;
+                }
+                if ((ch.change & SceneData::ModelChange::Color) && ch.color.rgba() != orig.color.rgba())
+                    same = false;
+                if ((ch.change & SceneData::ModelChange::Visible) && ch.visible != orig.visible)
+                    same = false;
+                if (!same)
+                    ++mismatches;
+                break;
+            }
+            }
+        });
+        if (count != f.cameraChanges.count() + f.lightChanges.count() + f.modelChanges.count())
+            ++mismatches;
+    }
+
+    // The hierarchy: parents are models that come before their children.
+    for (int i = 0; i < compact.entityCount(); ++i) {
+        const int parent = compact.parentIndex(i);
+        if (parent >= i || (parent >= 0 && compact.entityKind(parent) != CompactSceneData::Model))
+            ++mismatches;
+    }
+    return mismatches;
+}
+
+SceneData SceneParser::parse(const QString &fn, SceneIndex *index)
+{
+    TRACE_SCOPE_ARG("SceneParser::parse", "file", fn.toUtf8());
+    SceneData scene;
+    auto includeFilename = [&fn](const SceneSource::Line &l) {
+        return QFileInfo(fn).dir().filePath(QString::fromUtf8(l.c[1]));
+    };
+
+    // Indexing streams the files line by line, keeping memory flat however long
+    // the timeline is. Otherwise the main file is tokenized first and the files it
+    // includes in parallel: blockingMapped has this thread, usually a pool thread
+    // itself, take part instead of waiting on a full pool. Through the cache an
+    // edited include is the only one read again.
+    SceneSource main;
+    QStringList includeFiles;
+    QList<SceneSource> includes;
+    if (!index) {
+        main = tokenize(fn);
+        if (!main.isValid())
+            return scene;
+        for (const SceneSource::Line &l : main.lines) {
+            if (isInclude(l) && l.c.count() == 2 && !includeFiles.contains(includeFilename(l)))
+                includeFiles.append(includeFilename(l));
+        }
+        if (!includeFiles.isEmpty()) {
+            TRACE_SCOPE("includes");
+            includes = QtConcurrent::blockingMapped(includeFiles, &cachedSource);
+            for (const SceneSource &src : includes) {
+                if (!src.isValid())
                     return scene;
+                scene.includes.append(src.key);
+            }
+        }
+    }
+
+    TRACE_SCOPE("build");
+    bool inScene = false, inFrames = false;
+    QByteArray currentPrefab;
+    int lastModelSpc = 2;
+    QByteArray lastModelId;
+    QStack<QByteArray> parentModelIdStack;
+    SceneData::Frame *currentFrame = nullptr;
+    SceneData::Frame scratchFrame;
+    int lastFrameT = 0;
+    QString lastFrameFn; // empty until the first keyframe
+    QHash<QByteArray, QPair<QString, int> > modelIds; // where each was declared
+
+    auto pushModel = [&](const QByteArray &id, int spc) {
+        if (spc > lastModelSpc)
+            parentModelIdStack.push(lastModelId);
+        else if (spc < lastModelSpc) {
+            int s = lastModelSpc;
+            while (spc < s) {
+                parentModelIdStack.pop();
+                s -= 2;
+            }
+        }
+        lastModelSpc = spc;
+        lastModelId = id;
+    };
+
+    // Model trees and keyframes do not continue across the start or end of an include.
+    auto resetNesting = [&]() {
+        lastModelSpc = 2;
+        lastModelId.clear();
+        parentModelIdStack.clear();
+        currentFrame = nullptr;
+    };
+
+    auto startSection = [&]() {
+        inScene = inFrames = false;
+        currentPrefab.clear();
+        resetNesting();
+    };
+
+    auto buildLine = [&](const QString &fn, const SceneSource::Line &l) {
+        const int lineIdx = l.idx;
+        const int spc = l.spc;
+        const QByteArrayList &c(l.c);
+
+        if (spc == 0) {
+            if (c[0] == "scene" && c.count() == 1) {
+                startSection();
+                inScene = true;
+            } else if (c[0] == "prefab" && c.count() == 2) {
+                startSection();
+                if (scene.prefabs.contains(c[1])) {
+                    qWarning("%s: Duplicate prefab %s at line %d", qPrintable(fn), c[1].constData(), lineIdx);
+                    return false;
+                }
+                currentPrefab = c[1];
+                scene.prefabs.insert(currentPrefab, SceneData::Prefab());
+            } else if (c[0] == "frames" && c.count() == 2) {
+                startSection();
+                inFrames = true;
+                bool ok = false;
+                scene.totalTime = c[1].toInt(&ok);
+                if (!ok) {
+                    qWarning("%s: Malformed total time at line %d", qPrintable(fn), lineIdx);
+                    return false;
                 }
             } else {
-                if (inScene) {
-                    if (spc == 2) {
-                        if (c[0] == "camera" && c.count() == 2) {
-                            scene.cameras.insert(c[1]);
-                        } else if (c[0] == "light" && c.count() == 2) {
-                            scene.lights.insert(c[1]);
-                        } else if (c[0] == "model" && c.count() == 3) {
-                            scene.models.insert(c[1], parseModel(c, spc));
-                        } else {
-                            qWarning("%s: Malformed line %d, unknown entry %s", qPrintable(fn), lineIdx, c[0].constData());
-                            return scene;
-                        }
-                    } else {
-                        if (c[0] == "model" && c.count() == 3) {
-                            if (spc - lastModelSpc > 2) {
-                                qWarning("%s: Too many spaces at line %d", qPrintable(fn), lineIdx);
-                                return scene;
-                            }
-                            SceneData::Model mdl = parseModel(c, spc);
-                            // lazy. just walk the tree for now.
-                            QHash<QByteArray, SceneData::Model> *coll = &scene.models;
-                            for (const QByteArray &id : parentModelIdStack) {
-                                if (!coll->contains(id)) {
-                                    qWarning("%s: Malformed tree at line %d", qPrintable(fn), lineIdx);
-                                    return scene;
-                                }
-                                coll = &(*coll)[id].childModels;
-                            }
-                            coll->insert(lastModelId, mdl);
-                        } else {
-                            qWarning("%s: Malformed line %d, unknown entry %s", qPrintable(fn), lineIdx, c[0].constData());
-                            return scene;
+                qWarning("%s: Malformed line %d", qPrintable(fn), lineIdx);
+                return false;
+            }
+        } else {
+            if (inScene || !currentPrefab.isEmpty()) {
+                if (spc == 2 && inScene && c[0] == "camera" && c.count() == 2) {
+                    scene.cameras.insert(c[1]);
+                } else if (spc == 2 && inScene && c[0] == "light" && c.count() == 2) {
+                    scene.lights.insert(c[1]);
+                } else if (spc == 2 && inScene && c[0] == "light" && (c.count() == 4 || c.count() == 5) && c[2] == "point") {
+                    SceneData::PointLight light;
+                    bool ok = false;
+                    light.range = c[3].toFloat(&ok);
+                    if (c.count() == 5)
+                        light.color = QColor(QString::fromUtf8(c[4]));
+                    if (!ok || light.range <= 0 || !light.color.isValid()) {
+                        qWarning("%s: Malformed point light at line %d", qPrintable(fn), lineIdx);
+                        return false;
+                    }
+                    scene.lights.insert(c[1]);
+                    scene.pointLights.insert(c[1], light);
+                } else if (c[0] == "model" || c[0] == "instance" || c[0] == "array" || c[0] == "grid") {
+                    SceneData::Model mdl;
+                    if (!parseModelEntry(c, &mdl)) {
+                        qWarning("%s: Malformed %s entry at line %d", qPrintable(fn), c[0].constData(), lineIdx);
+                        return false;
+                    }
+                    if (!mdl.prefab.isEmpty() && !scene.prefabs.contains(mdl.prefab)) {
+                        qWarning("%s: Unknown prefab %s at line %d", qPrintable(fn), mdl.prefab.constData(), lineIdx);
+                        return false;
+                    }
+                    // The prefab being defined is already known, but cannot contain itself.
+                    if (!mdl.prefab.isEmpty() && mdl.prefab == currentPrefab) {
+                        qWarning("%s: Prefab %s instanced within itself at line %d", qPrintable(fn), mdl.prefab.constData(), lineIdx);
+                        return false;
+                    }
+                    if (spc - lastModelSpc > 2) {
+                        qWarning("%s: Too many spaces at line %d", qPrintable(fn), lineIdx);
+                        return false;
+                    }
+                    // Keyframes, live changes and recordings refer to models by id
+                    // alone, so an id is declared once, prefabs included.
+                    auto declared = modelIds.constFind(c[1]);
+                    if (declared != modelIds.constEnd()) {
+                        qWarning("%s: Duplicate model %s at line %d, already declared in %s at line %d",
+                                 qPrintable(fn), c[1].constData(), lineIdx,
+                                 qPrintable(declared->first), declared->second);
+                        return false;
+                    }
+                    modelIds.insert(c[1], qMakePair(fn, lineIdx));
+                    pushModel(c[1], spc);
+                    // lazy. just walk the tree for now.
+                    QHash<QByteArray, SceneData::Model> *coll = inScene ? &scene.models
+                                                                        : &scene.prefabs[currentPrefab].models;
+                    for (const QByteArray &id : parentModelIdStack) {
+                        if (!coll->contains(id)) {
+                            qWarning("%s: Malformed tree at line %d", qPrintable(fn), lineIdx);
+                            return false;
                         }
+                        coll = &(*coll)[id].childModels;
+                    }
+                    coll->insert(lastModelId, mdl);
+                } else {
+                    qWarning("%s: Malformed line %d, unknown entry %s", qPrintable(fn), lineIdx, c[0].constData());
+                    return false;
+                }
+            } else if (inFrames) {
+                if (spc == 2) {
+                    bool ok = false;
+                    const int t = c[0].toInt(&ok);
+                    if (!ok) {
+                        qWarning("%s: Invalid keyframe position at line %d", qPrintable(fn), lineIdx);
+                        return false;
                     }
-                } else if (inFrames) {
-                    if (spc == 2) {
-                        bool ok = false;
+                    // Keyframes are used in file order, includes and all, so
+                    // they must not go back in time.
+                    if (!lastFrameFn.isEmpty() && t < lastFrameT) {
+                        qWarning("%s: Keyframe position %d at line %d is before %d from %s",
+                                 qPrintable(fn), t, lineIdx, lastFrameT, qPrintable(lastFrameFn));
+                        return false;
+                    }
+                    lastFrameT = t;
+                    lastFrameFn = fn;
+                    // When indexing, only the first keyframe is kept.
+                    if (index && !scene.frames.isEmpty()) {
+                        scratchFrame = SceneData::Frame();
+                        currentFrame = &scratchFrame;
+                    } else {
                         scene.frames.append(SceneData::Frame());
                         currentFrame = &scene.frames.last();
-                        currentFrame->t = c[0].toInt(&ok);
-                        if (!ok) {
-                            qWarning("%s: Invalid keyframe position at line %d", qPrintable(fn), lineIdx);
-                            return scene;
-                        }
-                    } else if (spc == 4 && currentFrame) {
-                        if (scene.cameras.contains(c[0])) {
-                            SceneData::CameraChange ch;
-                            for (int i = 1; i < c.count(); ++i) {
-                                QByteArrayList propRef = c[i].split('.');
-                                if (propRef.count() == 2) {
-                                    if (propRef[0] == "pos") {
-                                        ch.change |= SceneData::CameraChange::Position;
-                                        if (propRef[1] == "x") {
-                                            ch.position.setX(c[i+1].toFloat());
-                                            ++i;
-                                        } else if (propRef[1] == "y") {
-                                            ch.position.setY(c[i+1].toFloat());
-                                            ++i;
-                                        } else if (propRef[1] == "z") {
-                                            ch.position.setZ(c[i+1].toFloat());
-                                            ++i;
-                                        }
-                                    } else if (propRef[0] == "view") {
-                                        ch.change |= SceneData::CameraChange::ViewCenter;
-                                        if (propRef[1] == "x") {
-                                            ch.viewCenter.setX(c[i+1].toFloat());
-                                            ++i;
-                                        } else if (propRef[1] == "y") {
-                                            ch.viewCenter.setY(c[i+1].toFloat());
-                                            ++i;
-                                        } else if (propRef[1] == "z") {
-                                            ch.viewCenter.setZ(c[i+1].toFloat());
-                                            ++i;
-                                        }
-                                    } else {
-                                        qWarning("%s: Unknown camera property reference '%s' at line %d", qPrintable(fn), propRef[0].constData(), lineIdx);
-                                    }
-                                }
-                            }
-                            currentFrame->cameraChanges.insert(c[0], ch);
-                        } else if (scene.lights.contains(c[0])) {
-                            SceneData::LightChange ch;
-                            for (int i = 1; i < c.count(); ++i) {
-                                QByteArrayList propRef = c[i].split('.');
-                                if (propRef.count() == 2) {
-                                    if (propRef[0] == "pos") {
-                                        ch.change |= SceneData::LightChange::Position;
-                                        if (propRef[1] == "x") {
-                                            ch.position.setX(c[i+1].toFloat());
-                                            ++i;
-                                        } else if (propRef[1] == "y") {
-                                            ch.position.setY(c[i+1].toFloat());
-                                            ++i;
-                                        } else if (propRef[1] == "z") {
-                                            ch.position.setZ(c[i+1].toFloat());
-                                            ++i;
-                                        }
-                                    } else {
-                                        qWarning("%s: Unknown light property reference '%s' at line %d", qPrintable(fn), propRef[0].constData(), lineIdx);
-                                    }
-                                }
-                            }
-                            currentFrame->lightChanges.insert(c[0], ch);
-                        } else if (scene.model(c[0])) {
-                            SceneData::ModelChange ch;
-                            for (int i = 1; i < c.count(); ++i) {
-                                QByteArrayList propRef = c[i].split('.');
-                                if (propRef.count() == 2) {
-                                    if (propRef[0] == "trans") {
-                                        if (propRef[1] == "x") {
-                                            ch.change |= SceneData::ModelChange::TranslationX;
-                                            ch.translation.setX(c[i+1].toFloat());
-                                            ++i;
-                                        } else if (propRef[1] == "y") {
-                                            ch.change |= SceneData::ModelChange::TranslationY;
-                                            ch.translation.setY(c[i+1].toFloat());
-                                            ++i;
-                                        } else if (propRef[1] == "z") {
-                                            ch.change |= SceneData::ModelChange::TranslationZ;
-                                            ch.translation.setZ(c[i+1].toFloat());
-                                            ++i;
-                                        }
-                                    } else if (propRef[0] == "rot") {
-                                        if (propRef[1] == "x") {
-                                            ch.change |= SceneData::ModelChange::RotationX;
-                                            ch.rotation.setX(c[i+1].toFloat());
-                                            ++i;
-                                        } else if (propRef[1] == "y") {
-                                            ch.change |= SceneData::ModelChange::RotationY;
-                                            ch.rotation.setY(c[i+1].toFloat());
-                                            ++i;
-                                        } else if (propRef[1] == "z") {
-                                            ch.change |= SceneData::ModelChange::RotationZ;
-                                            ch.rotation.setZ(c[i+1].toFloat());
-                                            ++i;
-                                        }
-                                    } else if (propRef[0] == "scale") {
-                                        if (propRef[1] == "x") {
-                                            ch.change |= SceneData::ModelChange::ScaleX;
-                                            ch.scale.setX(c[i+1].toFloat());
-                                            ++i;
-                                        } else if (propRef[1] == "y") {
-                                            ch.change |= SceneData::ModelChange::ScaleY;
-                                            ch.scale.setY(c[i+1].toFloat());
-                                            ++i;
-                                        } else if (propRef[1] == "z") {
-                                            ch.change |= SceneData::ModelChange::ScaleZ;
-                                            ch.scale.setZ(c[i+1].toFloat());
-                                            ++i;
-                                        }
-                                    } else {
-                                        qWarning("%s: Unknown model property reference '%s' at line %d", qPrintable(fn), propRef[0].constData(), lineIdx);
-                                        return scene;
-                                    }
-                                } else if (propRef.count() == 1) {
-                                    if (propRef[0] == "color") {
-                                        ch.change |= SceneData::ModelChange::Color;
-                                        ch.color = QColor(QString::fromUtf8(c[i+1]));
-                                        ++i;
-                                    } else {
-                                        qWarning("%s: Unknown model property reference '%s' at line %d", qPrintable(fn), propRef[0].constData(), lineIdx);
-                                        return scene;
-                                    }
-                                }
-                            }
-                            currentFrame->modelChanges.insert(c[0], ch);
-                        }
-                    } else {
-                        Q_UNREACHABLE();
                     }
+                    currentFrame->t = t;
+                    if (index)
+                        index->frames.append({ currentFrame->t, l.offset, lineIdx, fn });
+                } else if (spc == 4 && currentFrame) {
+                    if (!parseFrameLine(fn, lineIdx, c, &scene, currentFrame))
+                        return false;
+                    if (index && currentFrame->modelChanges.contains(c[0])) {
+                        const SceneData::ModelChange &ch(currentFrame->modelChanges[c[0]]);
+                        indexModelChange(index, currentFrame->t, c[0], ch);
+                        index->activity.addChange(currentFrame->t, c[0], ch);
+                    }
+                } else {
+                    qWarning("%s: Malformed line %d", qPrintable(fn), lineIdx);
+                    return false;
                 }
             }
         }
+        return true;
+    };
 
-        scene.valid = true;
-        return scene;
-    });
+    auto buildInclude = [&](const SceneSource::Line &l) {
+        if (l.c.count() != 2 || (!inScene && !inFrames)) {
+            qWarning("%s: Malformed include at line %d, only allowed in the scene and frames sections",
+                     qPrintable(fn), l.idx);
+            return false;
+        }
+        const QString includeFn = includeFilename(l);
+        auto buildIncluded = [&](const SceneSource::Line &il) {
+            if (il.spc == 0 || isInclude(il)) {
+                qWarning("%s: Malformed line %d, included files cannot start sections or include others",
+                         qPrintable(includeFn), il.idx);
+                return false;
+            }
+            return buildLine(includeFn, il);
+        };
+        resetNesting();
+        bool ok = true;
+        if (index) {
+            ok = forEachLine(includeFn, buildIncluded);
+        } else {
+            for (const SceneSource::Line &il : includes[includeFiles.indexOf(includeFn)].lines) {
+                if (!(ok = buildIncluded(il)))
+                    break;
+            }
+        }
+        resetNesting();
+        return ok;
+    };
+
+    auto buildMainLine = [&](const SceneSource::Line &l) {
+        return isInclude(l) ? buildInclude(l) : buildLine(fn, l);
+    };
+    if (index) {
+        if (!forEachLine(fn, buildMainLine))
+            return scene;
+    } else {
+        for (const SceneSource::Line &l : main.lines) {
+            if (!buildMainLine(l))
+                return scene;
+        }
+    }
+
+    scene.valid = true;
+
+    if (!index && lcSceneMemory().isDebugEnabled()) {
+        CompactSceneData compact;
+        compact.build(scene);
+        const size_t before = scene.memoryUsage();
+        const size_t after = compact.memoryUsage();
+        QElapsedTimer timer;
+        timer.start();
+        const int mismatches = compactMismatches(scene, compact);
+        qCDebug(lcSceneMemory, "%s: %d keyframes, SceneData ~%zu KB, CompactSceneData %zu KB (%.1f%%), read back in %lld ms, %d mismatches",
+                qPrintable(fn), scene.frames.count(), before / 1024, after / 1024,
+                before ? 100.0 * after / before : 0.0, timer.elapsed(), mismatches);
+    }
+
+    return scene;
+}
+
+void SceneActivity::addChange(int t, const QByteArray &modelId, const SceneData::ModelChange &ch)
+{
+    ModelState &m(m_models[modelId]);
+    // A keyframe repeating the previous value is a hold.
+    auto update = [&](int channel, bool changed) {
+        if (changed && t > m.lastTime[channel])
+            m_intervals.append(qMakePair(m.lastTime[channel], t));
+        m.lastTime[channel] = t;
+    };
+
+    if (ch.change & SceneData::ModelChange::Translation) {
+        QVector3D v = m.translation;
+        if (ch.change & SceneData::ModelChange::TranslationX)
+            v.setX(ch.translation.x());
+        if (ch.change & SceneData::ModelChange::TranslationY)
+            v.setY(ch.translation.y());
+        if (ch.change & SceneData::ModelChange::TranslationZ)
+            v.setZ(ch.translation.z());
+        update(SceneIndex::Translation, v != m.translation);
+        m.translation = v;
+    }
+    if (ch.change & SceneData::ModelChange::Rotation) {
+        QVector3D v = m.rotation;
+        if (ch.change & SceneData::ModelChange::RotationX)
+            v.setX(ch.rotation.x());
+        if (ch.change & SceneData::ModelChange::RotationY)
+            v.setY(ch.rotation.y());
+        if (ch.change & SceneData::ModelChange::RotationZ)
+            v.setZ(ch.rotation.z());
+        update(SceneIndex::Rotation, v != m.rotation);
+        m.rotation = v;
+    }
+    if (ch.change & SceneData::ModelChange::Scale) {
+        QVector3D v = m.scale;
+        if (ch.change & SceneData::ModelChange::ScaleX)
+            v.setX(ch.scale.x());
+        if (ch.change & SceneData::ModelChange::ScaleY)
+            v.setY(ch.scale.y());
+        if (ch.change & SceneData::ModelChange::ScaleZ)
+            v.setZ(ch.scale.z());
+        update(SceneIndex::Scale, v != m.scale);
+        m.scale = v;
+    }
+    if (ch.change & SceneData::ModelChange::Color) {
+        update(SceneIndex::Color, ch.color != m.color);
+        m.color = ch.color;
+    }
+    if (ch.change & SceneData::ModelChange::Visible) {
+        // A step; only the frame at t needs rendering.
+        if (ch.visible != m.visible)
+            m_intervals.append(qMakePair(t, t));
+        m.visible = ch.visible;
+    }
+
+    // Keeps long timelines from piling up overlapping intervals.
+    if (m_intervals.count() > 2 * m_compactedCount + 1024)
+        compact();
+}
+
+void SceneActivity::addFrames(const QVector<SceneData::Frame> &frames)
+{
+    for (const SceneData::Frame &f : frames) {
+        for (auto it = f.modelChanges.cbegin(), ite = f.modelChanges.cend(); it != ite; ++it)
+            addChange(f.t, it.key(), it.value());
+    }
+}
+
+void SceneActivity::compact()
+{
+    std::sort(m_intervals.begin(), m_intervals.end());
+    QVector<Interval> merged;
+    for (const Interval &i : qAsConst(m_intervals)) {
+        if (!merged.isEmpty() && i.first <= merged.last().second)
+            merged.last().second = qMax(merged.last().second, i.second);
+        else
+            merged.append(i);
+    }
+    m_intervals = merged;
+    m_compactedCount = m_intervals.count();
+}
+
+QVector<SceneActivity::Interval> SceneActivity::intervals() const
+{
+    SceneActivity a = *this;
+    a.compact();
+    return a.m_intervals;
+}
+
+SceneIndex SceneParser::index(const QString &fn)
+{
+    SceneIndex index;
+    SceneData header = parse(fn, &index);
+    if (header.isValid() && header.frames.isEmpty()) {
+        qWarning("%s: No keyframes", qPrintable(fn));
+        header.valid = false;
+    }
+    index.header = header;
+    if (!header.isValid()) {
+        index.frames.clear();
+        index.modelKeys.clear();
+    }
+    return index;
+}
+
+// Parses the keyframe at ref, reopening f when it lives in another file than the
+// previous one, which with includes it may.
+static bool readFrame(const SceneIndex::FrameRef &ref, QFile *f, SceneData *header, SceneData::Frame *frame)
+{
+    if (f->fileName() != ref.filename) {
+        f->close();
+        f->setFileName(ref.filename);
+        if (!f->open(QIODevice::ReadOnly)) {
+            qWarning("Failed to read keyframes from %s", qPrintable(ref.filename));
+            return false;
+        }
+    }
+    if (!f->seek(ref.offset)) {
+        qWarning("Failed to read keyframes from %s", qPrintable(ref.filename));
+        return false;
+    }
+
+    bool haveFrame = false;
+    int lineIdx = ref.line - 1;
+    while (!f->atEnd()) {
+        const QByteArray raw = f->readLine();
+        ++lineIdx;
+        int spc = 0;
+        while (spc < raw.size() && raw[spc] == ' ')
+            ++spc;
+        const QByteArray line = raw.mid(spc).trimmed();
+        if (line.isEmpty() || line.startsWith("//"))
+            continue;
+        if (haveFrame && spc <= 2)
+            break; // the next keyframe or the end of the frames section
+
+        const QByteArrayList c = line.split(' ');
+        if (!haveFrame) {
+            bool ok = false;
+            frame->t = c[0].toInt(&ok);
+            if (spc != 2 || !ok || frame->t != ref.t)
+                break;
+            haveFrame = true;
+        } else if (spc == 4) {
+            if (!parseFrameLine(ref.filename, lineIdx, c, header, frame))
+                return false;
+        }
+    }
+    if (!haveFrame) {
+        qWarning("%s: Invalid keyframe position at line %d, changed since indexing?",
+                 qPrintable(ref.filename), ref.line);
+        return false;
+    }
+    return true;
+}
+
+bool SceneParser::readFrames(const SceneIndex &index, int from,
+                             const std::function<bool(const SceneData::Frame &)> &func)
+{
+    SceneData header = index.header;
+    QFile f;
+    for (int i = from; i < index.frames.count(); ++i) {
+        SceneData::Frame frame;
+        if (!readFrame(index.frames[i], &f, &header, &frame))
+            return false;
+        if (!func(frame))
+            return true;
+    }
+    return true;
+}
+
+bool SceneParser::readFrames(const SceneIndex &index, const QVector<int> &frames,
+                             const std::function<bool(const SceneData::Frame &)> &func)
+{
+    SceneData header = index.header;
+    QFile f;
+    for (int i : frames) {
+        SceneData::Frame frame;
+        if (!readFrame(index.frames[i], &f, &header, &frame))
+            return false;
+        if (!func(frame))
+            return true;
+    }
+    return true;
+}
+
+int SceneIndex::findFrame(int t) const
+{
+    auto it = std::upper_bound(frames.cbegin(), frames.cend(), t, [](int t, const FrameRef &f) { return t < f.t; });
+    return int(it - frames.cbegin());
 }
 
 SceneData *SceneParser::data()
@@ -359,6 +970,8 @@ static void gatherFn(const QHash<QByteArray, SceneData::Model> &c, QSet<QString>
 {
     for (const SceneData::Model &mdl : c) {
         fn->insert(mdl.filename);
+        for (const QString &lodFn : mdl.lodFilenames)
+            fn->insert(lodFn);
         gatherFn(mdl.childModels, fn);
     }
 }
@@ -367,6 +980,9 @@ QSet<QString> SceneData::allModelFilenames() const
 {
     QSet<QString> fn;
     gatherFn(models, &fn);
+    for (const Prefab &prefab : prefabs)
+        gatherFn(prefab.models, &fn);
+    fn.remove(QString()); // prefab instances
     return fn;
 }
 
@@ -385,5 +1001,92 @@ static const SceneData::Model *findModel(const QByteArray &id, QHash<QByteArray,
 
 const SceneData::Model *SceneData::model(const QByteArray &id)
 {
-    return findModel(id, models);
+    if (const Model *m = findModel(id, models))
+        return m;
+
+    for (Prefab &prefab : prefabs) {
+        if (const Model *m = findModel(id, prefab.models))
+            return m;
+    }
+
+    return nullptr;
+}
+
+// Approximations of what the containers allocate on the heap. Good enough to
+// compare against CompactSceneData, not meant to be exact.
+static const size_t MallocOverhead = 16;
+
+static size_t byteArrayUsage(const QByteArray &b)
+{
+    return sizeof(QArrayData) + size_t(b.capacity()) + 1 + MallocOverhead;
+}
+
+static size_t stringUsage(const QString &s)
+{
+    return sizeof(QArrayData) + (size_t(s.capacity()) + 1) * sizeof(QChar) + MallocOverhead;
+}
+
+template <typename T>
+static size_t hashUsage(const QHash<QByteArray, T> &h)
+{
+    size_t n = size_t(h.capacity()) * sizeof(void *) + MallocOverhead; // buckets
+    for (auto it = h.cbegin(), ite = h.cend(); it != ite; ++it)
+        n += sizeof(void *) + sizeof(uint) + sizeof(QByteArray) + sizeof(T) + MallocOverhead + byteArrayUsage(it.key());
+    return n;
+}
+
+static size_t setUsage(const QSet<QByteArray> &set)
+{
+    size_t n = size_t(set.capacity()) * sizeof(void *) + MallocOverhead;
+    for (const QByteArray &b : set)
+        n += sizeof(void *) + sizeof(uint) + sizeof(QByteArray) + MallocOverhead + byteArrayUsage(b);
+    return n;
+}
+
+static size_t modelsUsage(const QHash<QByteArray, SceneData::Model> &models)
+{
+    size_t n = hashUsage(models);
+    for (const SceneData::Model &mdl : models) {
+        n += stringUsage(mdl.filename) + byteArrayUsage(mdl.prefab) + modelsUsage(mdl.childModels);
+        if (!mdl.lodFilenames.isEmpty()) {
+            n += 2 * (size_t(mdl.lodFilenames.count()) * sizeof(void *) + MallocOverhead); // names and thresholds
+            for (const QString &lodFn : mdl.lodFilenames)
+                n += stringUsage(lodFn);
+        }
+    }
+    return n;
+}
+
+size_t SceneData::memoryUsage() const
+{
+    size_t n = sizeof(SceneData) + setUsage(cameras) + setUsage(lights) + modelsUsage(models);
+    n += hashUsage(pointLights);
+    n += hashUsage(prefabs);
+    for (const Prefab &prefab : prefabs)
+        n += modelsUsage(prefab.models);
+    for (const QString &key : includes)
+        n += stringUsage(key);
+    n += size_t(frames.capacity()) * sizeof(Frame) + MallocOverhead;
+    for (const Frame &f : frames) {
+        n += hashUsage(f.cameraChanges) + hashUsage(f.lightChanges) + hashUsage(f.modelChanges);
+        for (const ModelChange &ch : f.modelChanges) {
+            if (!ch.easing.isEmpty()) {
+                n += size_t(ch.easing.capacity()) * sizeof(void *) + MallocOverhead;
+                n += size_t(ch.easing.count()) * (sizeof(void *) + sizeof(uint) + sizeof(int) + sizeof(Easing) + MallocOverhead);
+            }
+        }
+    }
+    return n;
+}
+
+size_t SceneSource::memoryUsage() const
+{
+    size_t n = sizeof(SceneSource) + stringUsage(filename) + stringUsage(key);
+    n += size_t(lines.capacity()) * sizeof(Line) + MallocOverhead;
+    for (const Line &l : lines) {
+        n += size_t(l.c.count()) * sizeof(void *) + MallocOverhead;
+        for (const QByteArray &b : l.c)
+            n += byteArrayUsage(b);
+    }
+    return n;
 }
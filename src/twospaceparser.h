@@ -52,24 +52,51 @@
 #define TWOSPACEPARSER_H
 
 #include <QString>
+#include <QStringList>
+#include <QVector>
 #include <QSet>
 #include <QHash>
 #include <QColor>
 #include <QVector3D>
 #include <QFuture>
+#include <QByteArrayList>
+#include <QPair>
+#include <climits>
+#include <functional>
 
 struct SceneData
 {
     bool isValid() const { return valid; }
     QSet<QString> allModelFilenames() const;
+    size_t memoryUsage() const; // rough estimate of the heap usage, for comparisons
     struct Model;
     const Model *model(const QByteArray &id);
 
     bool valid = false;
+    QStringList includes; // cache keys of the included files, see SceneCache
 
     struct Model {
-        QString filename;
+        QString filename; // empty for prefab instances
+        // Lower detail assets: lodFilenames[i] is used once the camera is further
+        // than lodThresholds[i] away or, with lodScreenSize, once the model's
+        // projected size drops below lodThresholds[i] pixels.
+        QStringList lodFilenames;
+        QVector<float> lodThresholds;
+        bool lodScreenSize = false;
+        // Instances of a prefab are laid out in a grid of instances[0] x instances[1] x instances[2]
+        // copies, instanceSpacing apart. A plain 'instance' is a 1x1x1 grid.
+        QByteArray prefab;
+        int instances[3] = { 1, 1, 1 };
+        QVector3D instanceSpacing;
         QHash<QByteArray, Model> childModels;
+
+        int instanceCount() const { return instances[0] * instances[1] * instances[2]; }
+    };
+
+    // A named model subtree that is defined once and referenced by any number of
+    // instances. Keyframes for the models inside apply to all instances alike.
+    struct Prefab {
+        QHash<QByteArray, Model> models;
     };
 
     struct CameraChange {
@@ -90,6 +117,18 @@ struct SceneData
         QVector3D position;
     };
 
+    // Cubic Bezier easing for the segment arriving at a keyframe, with the
+    // handles relative to the segment like CSS cubic-bezier().
+    struct Easing {
+        Easing() = default;
+        Easing(float x1, float y1, float x2, float y2) : x1(x1), y1(y1), x2(x2), y2(y2) { }
+        float x1 = 0;
+        float y1 = 0;
+        float x2 = 1;
+        float y2 = 1;
+        bool valid = false;
+    };
+
     struct ModelChange {
         enum Which {
             TranslationX = 0x01,
@@ -107,13 +146,19 @@ struct SceneData
             ScaleZ = 0x100,
             Scale = ScaleX | ScaleY | ScaleZ,
 
-            Color = 0x200
+            Color = 0x200,
+
+            Visible = 0x400, // a step, not part of the clips
+
+            Clip = Translation | Rotation | Scale | Color // what the animation clips carry
         };
         int change = 0;
         QVector3D translation;
         QVector3D rotation;
         QVector3D scale;
         QColor color;
+        bool visible = true;
+        QHash<int, Easing> easing; // Which bit -> easing, only for eased components
     };
 
     struct Frame {
@@ -125,15 +170,129 @@ struct SceneData
 
     QSet<QByteArray> cameras;
     QSet<QByteArray> lights;
+    // Lights declared as 'light <id> point <range> [<color>]', also in lights.
+    struct PointLight {
+        float range = 0;
+        QColor color = Qt::white;
+    };
+    QHash<QByteArray, PointLight> pointLights;
     QHash<QByteArray, Model> models;
+    QHash<QByteArray, Prefab> prefabs;
     int totalTime;
     QVector<Frame> frames;
 };
 
+// Finds the time ranges in which some model property moves between two
+// keyframes, as opposed to holding still. Changes must come in time order,
+// starting with the keyframe at t=0.
+class SceneActivity
+{
+public:
+    typedef QPair<int, int> Interval; // ms
+
+    void addChange(int t, const QByteArray &modelId, const SceneData::ModelChange &ch);
+    void addFrames(const QVector<SceneData::Frame> &frames);
+    // Sorted, non-overlapping.
+    QVector<Interval> intervals() const;
+
+private:
+    void compact();
+
+    struct ModelState {
+        QVector3D translation;
+        QVector3D rotation;
+        QVector3D scale = QVector3D(1, 1, 1);
+        QColor color = QColor::fromRgbF(0.7, 0.7, 0.7);
+        bool visible = true;
+        int lastTime[4] = { 0, 0, 0, 0 }; // per channel
+    };
+    QHash<QByteArray, ModelState> m_models;
+    QVector<Interval> m_intervals;
+    int m_compactedCount = 0;
+};
+
+// Where the keyframes are in a scene file, for streaming playback of timelines
+// too long to keep in memory. Built by SceneParser::index().
+struct SceneIndex
+{
+    struct FrameRef {
+        int t;
+        qint64 offset; // of the keyframe's time line
+        int line;
+        QString filename; // the scene file or the included file holding the keyframe
+    };
+
+    // Model properties animated together, in the order of the clip channels.
+    enum Channel {
+        Translation,
+        Rotation,
+        Scale,
+        Color,
+        ChannelCount
+    };
+    static int channelMask(int channel)
+    {
+        static const int masks[ChannelCount] = {
+            SceneData::ModelChange::Translation,
+            SceneData::ModelChange::Rotation,
+            SceneData::ModelChange::Scale,
+            SceneData::ModelChange::Color
+        };
+        return masks[channel];
+    }
+
+    struct ModelKeys {
+        int changes = 0; // everything changed after t=0
+        QVector<int> channelTimes[ChannelCount]; // keyframes after t=0 setting each channel
+        QVector<QPair<int, bool> > visibility; // visible keys, including t=0
+    };
+
+    bool isValid() const { return header.isValid(); }
+    int findFrame(int t) const; // index of the first keyframe after t
+
+    SceneData header; // everything but the keyframes after the first one
+    QVector<FrameRef> frames;
+    QHash<QByteArray, ModelKeys> modelKeys;
+    SceneActivity activity;
+};
+
+// A scene file split into lines, before any interpretation. Included files are
+// tokenized on the thread pool and cached on their own by SceneCache::source().
+struct SceneSource
+{
+    struct Line {
+        int idx;
+        int spc;
+        QByteArrayList c;
+        qint64 offset;
+    };
+
+    bool isValid() const { return valid; }
+    size_t memoryUsage() const;
+
+    bool valid = false;
+    QString filename;
+    QString key; // set by SceneCache
+    QVector<Line> lines;
+};
+
 class SceneParser
 {
 public:
-    void load(const QString &fn);
+    void load(const QString &fn); // asynchronous, goes through SceneCache
+    // synchronous; with an index only the first keyframe is kept in the result
+    static SceneData parse(const QString &fn, SceneIndex *index = nullptr);
+    static SceneIndex index(const QString &fn);
+    static SceneSource tokenize(const QString &fn);
+    // Parses the keyframes starting at index.frames[from], calling func with each
+    // until it returns false or the frames section ends.
+    static bool readFrames(const SceneIndex &index, int from,
+                           const std::function<bool(const SceneData::Frame &)> &func);
+    // The same for only the keyframes index.frames[i] of each i in frames, in that order.
+    static bool readFrames(const SceneIndex &index, const QVector<int> &frames,
+                           const std::function<bool(const SceneData::Frame &)> &func);
+    // c is a keyframe line split on spaces: <id> <property> <value> [<easing>] ...
+    static bool parseModelChange(const QByteArrayList &c, SceneData::ModelChange *ch, QByteArray *error);
     SceneData *data();
     bool isValid() { return data()->isValid(); }
     void reset();